@@ -14,6 +14,11 @@
 
 JPEGENC jpg;
 JPEGENCODE jpe;
+JPEGENC jpg2, jpg3; // smaller renditions for the pyramid test (and the alpha plane)
+JPEGENCODE jpe2, jpe3;
+uint8_t ucArithWork[JPEGE_ARITH_WORK_SIZE]; // arithmetic coder state
+uint8_t ucThumbWork[JPEGE_THUMB_WORK_SIZE(JPEGE_THUMB_MAX_SIZE)]; // thumbnail row sums
+uint8_t ucDCBuf[2048];
 const char *pRootName = NULL;
 uint8_t *pOut;
 uint16_t u16Temp[320 * 24]; // hold 16 lines for capturing the MCUs (16x16)
@@ -44,13 +49,18 @@ int32_t myRead(JPEGE_FILE *handle, uint8_t *buffer, int32_t length) {
     }
     return 0;
 }
+int iWriteCount; // number of calls to myWrite
 int32_t myWrite(JPEGE_FILE *handle, uint8_t *buffer, int32_t length) {
     FILE *fh = (FILE *)handle->fHandle;
+    iWriteCount++;
     if (fh != NULL) {
         return (int32_t)fwrite(buffer, length, 1, fh);
     }
     return 0;
 }
+uint8_t * myGrow(uint8_t *buffer, int32_t size) {
+    return (uint8_t *)realloc(buffer, size);
+}
 int32_t mySeek(JPEGE_FILE *handle, int32_t position) {
     FILE *fh = (FILE *)handle->fHandle;
     if (fh != NULL) {
@@ -77,7 +87,7 @@ int main(int argc, const char * argv[]) {
     int x, y, k, rc, iTotal;
     char *szTestName;
     uint32_t u32;
-    int iOutputSize;
+    int iOutputSize, iPredicted;
     int iTotalPass, iTotalFail;
     const char *szStart = " - START";
     int iDataSize = 0;
@@ -355,7 +365,12 @@ int main(int argc, const char * argv[]) {
                     } // for each MCU
                 } // for y
                 iDataSize = jpg.close();
-                u32 = *(uint32_t *)pOut;
+                u32 = 0;
+                f = fopen(szFile, "rb"); // check the start of the file we just wrote
+                if (f != NULL) {
+                    fread(&u32, 1, sizeof(u32), f);
+                    fclose(f);
+                }
                 if (iDataSize == 11076 && u32 == 0xe0ffd8ff) { // correct length the start of the JPEG header
                     iTotalPass++;
                     JPEGLOG(__LINE__, szTestName, " - PASSED");
@@ -372,6 +387,1223 @@ int main(int argc, const char * argv[]) {
         }
     }
 
+    // Test 9
+    iTotal++;
+    szTestName = (char *)"Test encoding an image with partial edge MCUs";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    w -= 3; h -= 5; // make both dimensions not a multiple of the MCU size
+    iOutputSize = 65536;
+    pOut = (uint8_t *)malloc(iOutputSize);
+    d = (uint8_t *)malloc(w * h * sizeof(uint16_t)); // exact size, no room for reading past the edges
+    for (y=0; y<h; y++) { // flip the bottom-up bitmap into a tightly packed buffer
+        memcpy(&d[y * w * 2], &rgb565[offset + (h + 4 - y) * pitch], w * sizeof(uint16_t));
+    }
+    rc = jpg.open(pOut, iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        rc = jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+        if (rc == JPEGE_SUCCESS) {
+            rc = jpg.addFrame(&jpe, d, w * sizeof(uint16_t));
+            iDataSize = jpg.close();
+            u32 = *(uint32_t *)pOut;
+            if (rc == JPEGE_SUCCESS && iDataSize == 10974 && u32 == 0xe0ffd8ff) {
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, pOut, iDataSize, iTotal);
+    }
+    free(d);
+    free(pOut);
+    // Test 10
+    iTotal++;
+    szTestName = (char *)"Test encoding a bottom-up image in place with a negative pitch";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    iOutputSize = 65536;
+    pOut = (uint8_t *)malloc(iOutputSize);
+    rc = jpg.open(pOut, iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        rc = jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+        if (rc == JPEGE_SUCCESS) {
+            // point to the top line of the image (the last one in memory)
+            rc = jpg.addFrame(&jpe, (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch);
+            iDataSize = jpg.close();
+            u32 = *(uint32_t *)pOut;
+            if (rc == JPEGE_SUCCESS && iDataSize == 11076 && u32 == 0xe0ffd8ff) { // same output as test 1
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, pOut, iDataSize, iTotal);
+    }
+    free(pOut);
+    // Test 11
+    iTotal++;
+    szTestName = (char *)"Test rotating an image 90 degrees while encoding";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    iOutputSize = 65536;
+    pOut = (uint8_t *)malloc(iOutputSize);
+    rc = jpg.open(pOut, iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        rc = jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH, JPEGE_ORIENT_ROT90);
+        if (rc == JPEGE_SUCCESS) {
+            k = jpg.addMCU(&jpe, (uint8_t *)&rgb565[offset], pitch); // not allowed when rotating
+            jpg.open(pOut, iOutputSize); // start over after the error
+            jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH, JPEGE_ORIENT_ROT90);
+            rc = jpg.addFrame(&jpe, (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch);
+            iDataSize = jpg.close();
+            u32 = *(uint32_t *)pOut;
+            for (x=2; x<iDataSize-9 && (pOut[x] != 0xff || pOut[x+1] != 0xc0); x++) {}; // find the SOF0 marker
+            if (k == JPEGE_UNSUPPORTED_FEATURE && rc == JPEGE_SUCCESS && iDataSize == 10917 && u32 == 0xe0ffd8ff &&
+                ((pOut[x+5] << 8) | pOut[x+6]) == w && ((pOut[x+7] << 8) | pOut[x+8]) == h) { // height and width are swapped
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, pOut, iDataSize, iTotal);
+    }
+    free(pOut);
+    // Test 12
+    iTotal++;
+    szTestName = (char *)"Test encoding a cropped rectangle in place";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    iOutputSize = 65536;
+    pOut = (uint8_t *)malloc(iOutputSize);
+    d = (uint8_t *)malloc(iOutputSize);
+    // first encode a copy of the crop, then encode the same rectangle in place
+    // (unaligned left edge and partial MCUs on the right and bottom)
+    for (y=0; y<151; y++) {
+        memcpy(&d[y * 203 * 2], &rgb565[offset + (h-1-(y+37)) * pitch + 13*2], 203 * 2);
+    }
+    rc = jpg.open(pOut, iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        rc = jpg.encodeBegin(&jpe, 203, 151, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+        if (rc == JPEGE_SUCCESS) {
+            rc = jpg.addFrame(&jpe, d, 203 * 2);
+            k = jpg.close(); // size of the copied crop
+            memcpy(d, pOut, k);
+            jpg.open(pOut, iOutputSize);
+            jpg.encodeBegin(&jpe, 203, 151, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+            rc = jpg.addFrame(&jpe, (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch, 13, 37, 203, 151);
+            iDataSize = jpg.close();
+            if (rc == JPEGE_SUCCESS && iDataSize == k && memcmp(d, pOut, k) == 0) { // must match the copied crop exactly
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, pOut, iDataSize, iTotal);
+    }
+    free(d);
+    free(pOut);
+    // Test 13
+    iTotal++;
+    szTestName = (char *)"Test downscaling by 2 while encoding";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    iOutputSize = 65536;
+    pOut = (uint8_t *)malloc(iOutputSize);
+    d = (uint8_t *)malloc(w * h * 3);
+    // first average each 2x2 block into an RGB888 image and encode that,
+    // then let the encoder do the same while reading the RGB565 source
+    for (y=0; y<h/2; y++) {
+        for (x=0; x<w/2; x++) {
+            int r = 0, g = 0, b = 0;
+            for (k=0; k<4; k++) {
+                uint16_t us = *(uint16_t *)&rgb565[offset + (h-1-(y*2+(k>>1))) * pitch + (x*2+(k&1))*2];
+                b += ((us & 0x1f)<<3) | (us & 7);
+                g += ((us & 0x7e0)>>3) | ((us & 0x60)>>5);
+                r += ((us & 0xf800)>>8) | ((us & 0x3800)>>11);
+            }
+            d[(y*(w/2)+x)*3] = (uint8_t)((b+2)>>2);
+            d[(y*(w/2)+x)*3+1] = (uint8_t)((g+2)>>2);
+            d[(y*(w/2)+x)*3+2] = (uint8_t)((r+2)>>2);
+        }
+    }
+    rc = jpg.open(pOut, iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        rc = jpg.encodeBegin(&jpe, w/2, h/2, JPEGE_PIXEL_RGB888, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+        if (rc == JPEGE_SUCCESS) {
+            rc = jpg.addFrame(&jpe, d, (w/2) * 3);
+            k = jpg.close(); // size of the pre-scaled image
+            memcpy(d, pOut, k);
+            jpg.open(pOut, iOutputSize);
+            jpg.encodeBegin(&jpe, w & ~1, h & ~1, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH, JPEGE_ORIENT_NONE, JPEGE_SCALE_HALF);
+            rc = jpg.addFrame(&jpe, (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch);
+            iDataSize = jpg.close();
+            if (rc == JPEGE_SUCCESS && iDataSize == k && memcmp(d, pOut, k) == 0) { // must match the pre-scaled image exactly
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, pOut, iDataSize, iTotal);
+    }
+    free(d);
+    free(pOut);
+
+    // Test 14
+    iTotal++;
+    szTestName = (char *)"Test encoding full, 1/2 and 1/8 size images in one pass";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    iOutputSize = 65536;
+    pOut = (uint8_t *)malloc(iOutputSize * 3);
+    d = (uint8_t *)malloc(iOutputSize);
+    // the half size image must match one encoded on its own
+    rc = jpg.open(d, iOutputSize);
+    jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH, JPEGE_ORIENT_NONE, JPEGE_SCALE_HALF);
+    jpg.addFrame(&jpe, (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch);
+    k = jpg.close();
+    rc |= jpg.open(pOut, iOutputSize);
+    rc |= jpg2.open(&pOut[iOutputSize], iOutputSize);
+    rc |= jpg3.open(&pOut[iOutputSize*2], iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        JPEGENC *pOthers[2] = {&jpg2, &jpg3};
+        JPEGENCODE *pOtherEncodes[2] = {&jpe2, &jpe3};
+        rc = jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+        rc |= jpg2.encodeBegin(&jpe2, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH, JPEGE_ORIENT_NONE, JPEGE_SCALE_HALF);
+        rc |= jpg3.encodeBegin(&jpe3, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH, JPEGE_ORIENT_NONE, JPEGE_SCALE_EIGHTH);
+        if (rc == JPEGE_SUCCESS) {
+            // the 1/8 image is made from the DC values of the full size one
+            rc = jpg.addFramePyramid(&jpe, pOthers, pOtherEncodes, 2, (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch, ucDCBuf, sizeof(ucDCBuf));
+            iDataSize = jpg.close();
+            int iHalfSize = jpg2.close();
+            y = jpg3.close();
+            uint8_t *pSmall = &pOut[iOutputSize*2];
+            for (x=2; x<y-9 && (pSmall[x] != 0xff || pSmall[x+1] != 0xc0); x++) {}; // find the SOF0 marker of the 1/8 image
+            if (rc == JPEGE_SUCCESS && iDataSize == 11076 && iHalfSize == k && memcmp(d, &pOut[iOutputSize], k) == 0 &&
+                jpg3.getLastError() == JPEGE_SUCCESS && x < y-9 &&
+                ((pSmall[x+5] << 8) | pSmall[x+6]) == (h+7)/8 && ((pSmall[x+7] << 8) | pSmall[x+8]) == (w+7)/8) {
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, &pOut[iOutputSize*2], y, iTotal);
+    }
+    free(d);
+    free(pOut);
+
+    // Test 15
+    iTotal++;
+    szTestName = (char *)"Test embedding a thumbnail in the JFIF header";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    iOutputSize = 65536;
+    pOut = (uint8_t *)malloc(iOutputSize);
+    d = (uint8_t *)malloc(iOutputSize);
+    rc = jpg.open(pOut, iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        jpg.setThumbnail(JPEGE_THUMB_MAX_SIZE, ucThumbWork, sizeof(ucThumbWork));
+        rc = jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+        if (rc == JPEGE_SUCCESS) {
+            rc = jpg.addFrame(&jpe, (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch);
+            iDataSize = jpg.close();
+            // one thumbnail pixel for every 16x16 block (one 4:2:0 MCU)
+            k = 0;
+            for (x=0; x<(w/16)*(h/16)*3; x++) {
+                k |= pOut[20 + x];
+            }
+            if (rc == JPEGE_SUCCESS && iDataSize == 11076 + (w/16)*(h/16)*3 && pOut[18] == w/16 && pOut[19] == h/16 &&
+                ((pOut[4] << 8) | pOut[5]) == 16 + (w/16)*(h/16)*3 && k != 0) {
+                k = 1;
+                if (pRootName) { // the thumbnail is written back with the seek callback when writing a file
+                    char szFile[256];
+                    snprintf(szFile, sizeof(szFile), "%s%d.jpg", pRootName, iTotal);
+                    jpg.open(szFile, myOpen, myClose, myRead, myWrite, mySeek);
+                    jpg.setThumbnail(JPEGE_THUMB_MAX_SIZE, ucThumbWork, sizeof(ucThumbWork));
+                    jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+                    jpg.addFrame(&jpe, (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch);
+                    x = jpg.close();
+                    f = fopen(szFile, "rb");
+                    if (f != NULL) {
+                        y = (int)fread(d, 1, iOutputSize, f);
+                        fclose(f);
+                        k = (x == iDataSize && y == iDataSize && memcmp(d, pOut, iDataSize) == 0);
+                    } else {
+                        k = 0;
+                    }
+                }
+            } else {
+                k = 0;
+            }
+            if (k) {
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    free(d);
+    free(pOut);
+
+    // Test 16
+    iTotal++;
+    szTestName = (char *)"Test encoding planar YUV 4:2:0 (I420 and NV21)";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    iOutputSize = 65536;
+    pOut = (uint8_t *)malloc(iOutputSize * 2);
+    d = (uint8_t *)malloc(w * h * 3); // room for both layouts of the planes
+    // make I420 planes from the RGB565 image
+    for (y=0; y<h; y++) {
+        s = (uint16_t *)&rgb565[offset + (h-1-y) * pitch];
+        for (x=0; x<w; x++) {
+            b = (unsigned char)(((s[x] & 0x1f)<<3) | (s[x] & 7));
+            g = (unsigned char)(((s[x] & 0x7e0)>>3) | ((s[x] & 0x60)>>5));
+            r = (unsigned char)(((s[x] & 0xf800)>>8) | ((s[x] & 0x3800)>>11));
+            k = (r * 77 + g * 150 + b * 29) >> 8;
+            d[y * w + x] = (uint8_t)k;
+            if (((x | y) & 1) == 0) {
+                d[w*h + (y/2)*(w/2) + x/2] = (uint8_t)((((b - k) * 144) >> 8) + 128); // U
+                d[w*h + (w/2)*(h/2) + (y/2)*(w/2) + x/2] = (uint8_t)((((r - k) * 183) >> 8) + 128); // V
+            }
+        }
+    }
+    rc = jpg.open(pOut, iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        rc = jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_I420, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+        if (rc == JPEGE_SUCCESS) {
+            k = jpg.addMCU(&jpe, d, w); // planar needs the whole frame
+            jpg.open(pOut, iOutputSize); // start over after the error
+            jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_I420, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+            rc = jpg.addFrame(&jpe, d, w);
+            iDataSize = jpg.close();
+            // the same planes with interleaved chroma must give the same JPEG
+            for (y=0; y<(w/2)*(h/2); y++) {
+                d[w*h*2 + y*2] = d[w*h + (w/2)*(h/2) + y]; // NV21 = V, U
+                d[w*h*2 + y*2 + 1] = d[w*h + y];
+            }
+            memcpy(&d[w*h], &d[w*h*2], (w/2)*(h/2)*2);
+            rc |= jpg.open(&pOut[iOutputSize], iOutputSize);
+            rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_NV21, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+            rc |= jpg.addFrame(&jpe, d, w);
+            x = jpg.close();
+            if (rc == JPEGE_SUCCESS && k == JPEGE_UNSUPPORTED_FEATURE && iDataSize == 11179 && x == iDataSize && memcmp(pOut, &pOut[iOutputSize], x) == 0) {
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, pOut, iDataSize, iTotal);
+    }
+    free(d);
+    free(pOut);
+
+    // Test 17
+    iTotal++;
+    szTestName = (char *)"Test encoding YUYV/UYVY pixels as 4:2:2 and 4:4:4";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    iOutputSize = 65536;
+    pOut = (uint8_t *)malloc(iOutputSize * 2);
+    d = (uint8_t *)malloc(w * h * 2);
+    // make YUYV pixels from the RGB565 image (U/V from the left pixel of each pair)
+    for (y=0; y<h; y++) {
+        s = (uint16_t *)&rgb565[offset + (h-1-y) * pitch];
+        for (x=0; x<w; x++) {
+            b = (unsigned char)(((s[x] & 0x1f)<<3) | (s[x] & 7));
+            g = (unsigned char)(((s[x] & 0x7e0)>>3) | ((s[x] & 0x60)>>5));
+            r = (unsigned char)(((s[x] & 0xf800)>>8) | ((s[x] & 0x3800)>>11));
+            k = (r * 77 + g * 150 + b * 29) >> 8;
+            d[y * w * 2 + x * 2] = (uint8_t)k;
+            if ((x & 1) == 0) {
+                d[y * w * 2 + x * 2 + 1] = (uint8_t)((((b - k) * 144) >> 8) + 128); // U
+                d[y * w * 2 + x * 2 + 3] = (uint8_t)((((r - k) * 183) >> 8) + 128); // V
+            }
+        }
+    }
+    rc = jpg.open(pOut, iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        rc = jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_YUV422, JPEGE_SUBSAMPLE_422, JPEGE_Q_HIGH);
+        if (rc == JPEGE_SUCCESS) {
+            rc = jpg.addFrame(&jpe, d, w * 2);
+            iDataSize = jpg.close();
+            for (k=0; k<iDataSize-1 && (pOut[k] != 0xff || pOut[k+1] != 0xc0); k++) {};
+            rc |= jpg.open(&pOut[iOutputSize], iOutputSize);
+            rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_YUV422, JPEGE_SUBSAMPLE_444, JPEGE_Q_HIGH);
+            rc |= jpg.addFrame(&jpe, d, w * 2);
+            x = jpg.close();
+            // the same pixels as UYVY must give the same JPEG as YUYV
+            for (y=0; y<w*h*2; y+=2) {
+                b = d[y]; d[y] = d[y+1]; d[y+1] = b;
+            }
+            rc |= jpg.open(&pOut[iOutputSize], iOutputSize);
+            rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_UYVY, JPEGE_SUBSAMPLE_422, JPEGE_Q_HIGH);
+            rc |= jpg.addFrame(&jpe, d, w * 2);
+            y = jpg.close();
+            if (rc == JPEGE_SUCCESS && iDataSize == 12034 && pOut[k+11] == 0x21 && pOut[k+14] == 0x11 && x == 13952 && y == iDataSize && memcmp(pOut, &pOut[iOutputSize], y) == 0) {
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, pOut, iDataSize, iTotal);
+    }
+    free(d);
+    free(pOut);
+
+    // Test 18
+    iTotal++;
+    szTestName = (char *)"Test byte-swapped RGB565 and BGRA8888 pixels";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    iOutputSize = 65536;
+    pOut = (uint8_t *)malloc(iOutputSize * 2);
+    d = (uint8_t *)malloc(w * h * 4);
+    // big-endian copy of the RGB565 image
+    for (y=0; y<h; y++) {
+        s = (uint16_t *)&rgb565[offset + (h-1-y) * pitch];
+        for (x=0; x<w; x++) {
+            d[(y * w + x) * 2] = (uint8_t)(s[x] >> 8);
+            d[(y * w + x) * 2 + 1] = (uint8_t)s[x];
+        }
+    }
+    rc = jpg.open(pOut, iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        rc = jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH, JPEGE_ORIENT_FLIPV);
+        if (rc == JPEGE_SUCCESS) {
+            rc = jpg.addFrame(&jpe, (uint8_t *)&rgb565[offset], pitch);
+            iDataSize = jpg.close();
+            rc |= jpg.open(&pOut[iOutputSize], iOutputSize);
+            rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565_BE, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+            rc |= jpg.addFrame(&jpe, d, w * 2);
+            k = jpg.close();
+            // the same image as R,G,B,A and B,G,R,A
+            for (y=0; y<h; y++) {
+                s = (uint16_t *)&rgb565[offset + (h-1-y) * pitch];
+                for (x=0; x<w; x++) {
+                    d[(y * w + x) * 4] = (uint8_t)(((s[x] & 0xf800)>>8) | ((s[x] & 0x3800)>>11));
+                    d[(y * w + x) * 4 + 1] = (uint8_t)(((s[x] & 0x7e0)>>3) | ((s[x] & 0x60)>>5));
+                    d[(y * w + x) * 4 + 2] = (uint8_t)(((s[x] & 0x1f)<<3) | (s[x] & 7));
+                    d[(y * w + x) * 4 + 3] = 0xff;
+                }
+            }
+            if (rc == JPEGE_SUCCESS && k == iDataSize && memcmp(pOut, &pOut[iOutputSize], k) == 0) {
+                rc |= jpg.open(pOut, iOutputSize);
+                rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGBA8888, JPEGE_SUBSAMPLE_444, JPEGE_Q_HIGH);
+                rc |= jpg.addFrame(&jpe, d, w * 4);
+                iDataSize = jpg.close();
+                for (y=0; y<w*h*4; y+=4) { // swap red and blue
+                    b = d[y]; d[y] = d[y+2]; d[y+2] = b;
+                }
+                rc |= jpg.open(&pOut[iOutputSize], iOutputSize);
+                rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_BGRA8888, JPEGE_SUBSAMPLE_444, JPEGE_Q_HIGH);
+                rc |= jpg.addFrame(&jpe, d, w * 4);
+                k = jpg.close();
+            } else {
+                k = 0;
+            }
+            if (rc == JPEGE_SUCCESS && k == iDataSize && iDataSize == 13845 && memcmp(pOut, &pOut[iOutputSize], k) == 0) {
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, pOut, iDataSize, iTotal);
+    }
+    free(d);
+    free(pOut);
+
+    // Test 19
+    iTotal++;
+    szTestName = (char *)"Test encoding 8 and 12-bit Bayer (RGGB) data";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    iOutputSize = 65536;
+    pOut = (uint8_t *)malloc(iOutputSize * 2);
+    d = (uint8_t *)malloc(w * h * 3); // 8-bit samples followed by 16-bit ones
+    // sample the RGB565 image through a RGGB color filter
+    for (y=0; y<h; y++) {
+        s = (uint16_t *)&rgb565[offset + (h-1-y) * pitch];
+        for (x=0; x<w; x++) {
+            if ((x & 1) != (y & 1)) // green
+                k = ((s[x] & 0x7e0)>>3) | ((s[x] & 0x60)>>5);
+            else if ((y & 1) == 0) // red
+                k = ((s[x] & 0xf800)>>8) | ((s[x] & 0x3800)>>11);
+            else // blue
+                k = ((s[x] & 0x1f)<<3) | (s[x] & 7);
+            d[y * w + x] = (uint8_t)k;
+            k = (k << 4) | (x & 15); // 12 bits with some noise in the low bits
+            d[w*h + (y * w + x) * 2] = (uint8_t)k;
+            d[w*h + (y * w + x) * 2 + 1] = (uint8_t)(k >> 8);
+        }
+    }
+    rc = jpg.open(pOut, iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        rc = jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_BAYER_RGGB, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+        if (rc == JPEGE_SUCCESS) {
+            rc = jpg.addFrame(&jpe, d, w);
+            iDataSize = jpg.close();
+            rc |= jpg.open(&pOut[iOutputSize], iOutputSize);
+            rc |= jpg.setSampleBits(12);
+            rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_BAYER16_RGGB, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+            rc |= jpg.addFrame(&jpe, &d[w*h], w * 2);
+            k = jpg.close();
+            if (rc == JPEGE_SUCCESS && iDataSize == 9789 && k == iDataSize && memcmp(pOut, &pOut[iOutputSize], k) == 0) {
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, pOut, iDataSize, iTotal);
+    }
+    free(d);
+    free(pOut);
+
+    // Test 20
+    iTotal++;
+    szTestName = (char *)"Test encoding RGB48 with a tone map and 16-bit grayscale";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    iOutputSize = 65536;
+    pOut = (uint8_t *)malloc(iOutputSize * 2);
+    d = (uint8_t *)malloc(w * h * 9 + 65536); // B,G,R, then R,G,B 16-bit, then the LUT
+    for (y=0; y<h; y++) {
+        s = (uint16_t *)&rgb565[offset + (h-1-y) * pitch];
+        for (x=0; x<w; x++) {
+            uint8_t *pRGB = &d[(y * w + x) * 3];
+            uint8_t *p48 = &d[w*h*3 + (y * w + x) * 6];
+            pRGB[0] = (uint8_t)(((s[x] & 0x1f)<<3) | (s[x] & 7));
+            pRGB[1] = (uint8_t)(((s[x] & 0x7e0)>>3) | ((s[x] & 0x60)>>5));
+            pRGB[2] = (uint8_t)(((s[x] & 0xf800)>>8) | ((s[x] & 0x3800)>>11));
+            for (k=0; k<3; k++) { // inverted, with some noise in the low byte
+                int iSample = ((255 - pRGB[2-k]) << 8) | (x & 0xff);
+                p48[k*2] = (uint8_t)iSample;
+                p48[k*2+1] = (uint8_t)(iSample >> 8);
+            }
+        }
+    }
+    for (k=0; k<65536; k++) // undo the inversion
+        d[w*h*9 + k] = (uint8_t)(255 - (k >> 8));
+    rc = jpg.open(pOut, iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        rc = jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB888, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+        if (rc == JPEGE_SUCCESS) {
+            rc = jpg.addFrame(&jpe, d, w * 3);
+            iDataSize = jpg.close();
+            rc |= jpg.open(&pOut[iOutputSize], iOutputSize);
+            rc |= jpg.setToneMap(&d[w*h*9]);
+            rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB48, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+            rc |= jpg.addFrame(&jpe, &d[w*h*3], w * 6);
+            k = jpg.close();
+            if (rc == JPEGE_SUCCESS && iDataSize == 11076 && k == iDataSize && memcmp(pOut, &pOut[iOutputSize], k) == 0) {
+                // the green channel as 16-bit grayscale (plain shift) vs 8-bit
+                for (x=0; x<w*h; x++) {
+                    d[w*h*3 + x*2] = (uint8_t)x; // noise below 8 bits
+                    d[w*h*3 + x*2 + 1] = d[x*3 + 1];
+                    d[x] = d[x*3 + 1];
+                }
+                rc = jpg.open(pOut, iOutputSize);
+                rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_GRAYSCALE, JPEGE_SUBSAMPLE_444, JPEGE_Q_HIGH);
+                rc |= jpg.addFrame(&jpe, d, w);
+                iDataSize = jpg.close();
+                rc |= jpg.open(&pOut[iOutputSize], iOutputSize);
+                rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_GRAY16, JPEGE_SUBSAMPLE_444, JPEGE_Q_HIGH);
+                rc |= jpg.addFrame(&jpe, &d[w*h*3], w * 2);
+                k = jpg.close();
+            } else {
+                rc = JPEGE_INVALID_PARAMETER;
+            }
+            if (rc == JPEGE_SUCCESS && iDataSize == 9854 && k == iDataSize && memcmp(pOut, &pOut[iOutputSize], k) == 0) {
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, pOut, iDataSize, iTotal);
+    }
+    free(d);
+    free(pOut);
+
+    // Test 21
+    iTotal++;
+    szTestName = (char *)"Test encoding the alpha plane of RGBA8888 in the same pass";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    iOutputSize = 65536;
+    pOut = (uint8_t *)malloc(iOutputSize * 4); // color, alpha, and the two references
+    d = (uint8_t *)malloc(w * h * 5); // R,G,B,A followed by the alpha values
+    for (y=0; y<h; y++) {
+        s = (uint16_t *)&rgb565[offset + (h-1-y) * pitch];
+        for (x=0; x<w; x++) {
+            uint8_t *pRGBA = &d[(y * w + x) * 4];
+            pRGBA[0] = (uint8_t)(((s[x] & 0xf800)>>8) | ((s[x] & 0x3800)>>11));
+            pRGBA[1] = (uint8_t)(((s[x] & 0x7e0)>>3) | ((s[x] & 0x60)>>5));
+            pRGBA[2] = (uint8_t)(((s[x] & 0x1f)<<3) | (s[x] & 7));
+            pRGBA[3] = (uint8_t)((x * 255) / w); // left to right fade
+            if ((x - w/2)*(x - w/2) + (y - h/2)*(y - h/2) < (h/4)*(h/4))
+                pRGBA[3] = 0; // with a hole in the middle
+            d[w*h*4 + y * w + x] = pRGBA[3];
+        }
+    }
+    rc = jpg.open(pOut, iOutputSize);
+    rc |= jpg2.open(&pOut[iOutputSize], iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        rc = jpg.setAlphaEncoder(&jpg2, &jpe2);
+        rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_ARGB8888, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+        if (rc == JPEGE_SUCCESS) {
+            rc = jpg.addFrame(&jpe, d, w * 4);
+            iDataSize = jpg.close();
+            k = jpg2.close();
+            // the same color image and alpha values encoded separately
+            rc |= jpg.open(&pOut[iOutputSize*2], iOutputSize);
+            rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_ARGB8888, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+            rc |= jpg.addFrame(&jpe, d, w * 4);
+            x = jpg.close();
+            rc |= jpg.open(&pOut[iOutputSize*3], iOutputSize);
+            rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_GRAYSCALE, JPEGE_SUBSAMPLE_444, JPEGE_Q_HIGH);
+            rc |= jpg.addFrame(&jpe, &d[w*h*4], w);
+            y = jpg.close();
+            if (rc == JPEGE_SUCCESS && iDataSize == 11076 && k == 3527 && x == iDataSize && y == k &&
+                memcmp(pOut, &pOut[iOutputSize*2], x) == 0 && memcmp(&pOut[iOutputSize], &pOut[iOutputSize*3], y) == 0) {
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, &pOut[iOutputSize], k, iTotal);
+    }
+    free(d);
+    free(pOut);
+
+    // Test 22
+    iTotal++;
+    szTestName = (char *)"Test luma-only (4:0:0) encoding of a color image";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    iOutputSize = 65536;
+    pOut = (uint8_t *)malloc(iOutputSize * 2);
+    d = (uint8_t *)malloc(w * h * 4); // B,G,R followed by the luma
+    for (y=0; y<h; y++) {
+        s = (uint16_t *)&rgb565[offset + (h-1-y) * pitch];
+        for (x=0; x<w; x++) {
+            uint8_t *pRGB = &d[(y * w + x) * 3];
+            pRGB[0] = (uint8_t)(((s[x] & 0x1f)<<3) | (s[x] & 7));
+            pRGB[1] = (uint8_t)(((s[x] & 0x7e0)>>3) | ((s[x] & 0x60)>>5));
+            pRGB[2] = (uint8_t)(((s[x] & 0xf800)>>8) | ((s[x] & 0x3800)>>11));
+            d[w*h*3 + y * w + x] = (uint8_t)((pRGB[2] * 1225 + pRGB[1] * 2404 + pRGB[0] * 467) >> 12);
+        }
+    }
+    rc = jpg.open(pOut, iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        rc = jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB888, JPEGE_SUBSAMPLE_400, JPEGE_Q_HIGH);
+        if (rc == JPEGE_SUCCESS) {
+            rc = jpg.addFrame(&jpe, d, w * 3);
+            iDataSize = jpg.close();
+            rc |= jpg.open(&pOut[iOutputSize], iOutputSize);
+            rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_GRAYSCALE, JPEGE_SUBSAMPLE_444, JPEGE_Q_HIGH);
+            rc |= jpg.addFrame(&jpe, &d[w*h*3], w);
+            k = jpg.close();
+            if (rc == JPEGE_SUCCESS && iDataSize == 9475 && k == iDataSize && memcmp(pOut, &pOut[iOutputSize], k) == 0) {
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, pOut, iDataSize, iTotal);
+    }
+    free(d);
+    free(pOut);
+
+    // Test 23
+    iTotal++;
+    szTestName = (char *)"Test progressive (SOF2) encoding";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    iOutputSize = 65536;
+    pOut = (uint8_t *)malloc(iOutputSize);
+    k = jpg.getProgressiveSize(w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420);
+    d = (uint8_t *)malloc(k);
+    rc = jpg.open(pOut, iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        jpg.setProgressive(d, k - 1024); // too small
+        rc = (jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH) == JPEGE_NO_BUFFER) ? JPEGE_SUCCESS : JPEGE_INVALID_PARAMETER;
+        rc |= jpg.open(pOut, iOutputSize);
+        rc |= jpg.setProgressive(d, k);
+        rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+        if (rc == JPEGE_SUCCESS) {
+            rc = jpg.addFrame(&jpe, (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch);
+            iDataSize = jpg.close();
+            if (rc == JPEGE_SUCCESS && iDataSize == 10296 && pOut[iDataSize-2] == 0xff && pOut[iDataSize-1] == 0xd9) {
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, pOut, iDataSize, iTotal);
+    }
+    free(d);
+    free(pOut);
+
+    // Test 24
+    iTotal++;
+    szTestName = (char *)"Test arithmetic coding (SOF9)";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    iOutputSize = 65536;
+    pOut = (uint8_t *)malloc(iOutputSize);
+    rc = jpg.open(pOut, iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        jpg.setArithmetic(ucArithWork, sizeof(ucArithWork));
+        rc = jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+        if (rc == JPEGE_SUCCESS) {
+            rc = jpg.addFrame(&jpe, (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch);
+            iDataSize = jpg.close();
+            for (k=2; k<iDataSize-1 && !(pOut[k] == 0xff && pOut[k+1] == 0xc9); k++) {}; // find the SOF9 marker
+            if (rc == JPEGE_SUCCESS && iDataSize == 8918 && k < iDataSize-1) { // 11076 with Huffman coding
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, pOut, iDataSize, iTotal);
+    }
+    free(pOut);
+
+    // Test 25
+    iTotal++;
+    szTestName = (char *)"Test trellis quantization";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    iOutputSize = 65536;
+    pOut = (uint8_t *)malloc(iOutputSize);
+    rc = jpg.open(pOut, iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        rc = (jpg.setTrellis(65536) == JPEGE_INVALID_PARAMETER) ? JPEGE_SUCCESS : JPEGE_INVALID_PARAMETER;
+        rc |= jpg.open(pOut, iOutputSize);
+        rc |= jpg.setTrellis(32);
+        rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_BEST);
+        if (rc == JPEGE_SUCCESS) {
+            rc = jpg.addFrame(&jpe, (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch);
+            iDataSize = jpg.close();
+            if (rc == JPEGE_SUCCESS && iDataSize == 9916) { // 16560 without the trellis
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, pOut, iDataSize, iTotal);
+    }
+    free(pOut);
+
+    // Test 26
+    iTotal++;
+    szTestName = (char *)"Test dead zone and isolated coefficient suppression";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    iOutputSize = 65536;
+    pOut = (uint8_t *)malloc(iOutputSize);
+    rc = jpg.open(pOut, iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        rc = (jpg.setDeadZone(2, 4, 4) == JPEGE_INVALID_PARAMETER) ? JPEGE_SUCCESS : JPEGE_INVALID_PARAMETER;
+        rc |= jpg.setDeadZone(0, 6, 4);
+        rc |= jpg.setDeadZone(1, 8, 2);
+        rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+        if (rc == JPEGE_SUCCESS) {
+            rc = jpg.addFrame(&jpe, (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch);
+            iDataSize = jpg.close();
+            if (rc == JPEGE_SUCCESS && iDataSize == 8998) { // 11076 without it
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, pOut, iDataSize, iTotal);
+    }
+    free(pOut);
+
+    // Test 27
+    iTotal++;
+    szTestName = (char *)"Test region of interest map";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    bytewidth = (w + 15) / 16; // one byte per 16x16 MCU
+    d = (uint8_t *)malloc(bytewidth * ((h + 15) / 16));
+    for (y=0; y<(h + 15) / 16; y++) { // keep the center, drop the rest to DC only
+        for (x=0; x<bytewidth; x++) {
+            d[y * bytewidth + x] = (x >= bytewidth/4 && x < bytewidth*3/4 && y >= (h+15)/64 && y < (h+15)*3/64) ? 255 : 0;
+        }
+    }
+    iOutputSize = 65536;
+    pOut = (uint8_t *)malloc(iOutputSize);
+    rc = jpg.open(pOut, iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        rc = jpg.setROI(d, bytewidth - 1);
+        rc |= (jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH) == JPEGE_INVALID_PARAMETER) ? JPEGE_SUCCESS : JPEGE_INVALID_PARAMETER;
+        rc |= jpg.open(pOut, iOutputSize);
+        rc |= jpg.setROI(d, bytewidth);
+        rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+        if (rc == JPEGE_SUCCESS) {
+            rc = jpg.addFrame(&jpe, (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch);
+            iDataSize = jpg.close();
+            if (rc == JPEGE_SUCCESS && iDataSize == 5779) { // 11076 without the map
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, pOut, iDataSize, iTotal);
+    }
+    free(pOut);
+    free(d);
+
+    // Test 28
+    iTotal++;
+    szTestName = (char *)"Test restart interval";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    iOutputSize = 65536;
+    pOut = (uint8_t *)malloc(iOutputSize);
+    rc = jpg.open(pOut, iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        rc = jpg.setRestartInterval(4000, JPEGE_RESTART_ROWS); // 80000 MCUs don't fit in the DRI
+        rc |= (jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH) == JPEGE_INVALID_PARAMETER) ? JPEGE_SUCCESS : JPEGE_INVALID_PARAMETER;
+        rc |= jpg.open(pOut, iOutputSize);
+        rc |= jpg.setRestartInterval(0, JPEGE_RESTART_MCUS);
+        rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+        if (rc == JPEGE_SUCCESS) {
+            rc = jpg.addFrame(&jpe, (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch);
+            iDataSize = jpg.close();
+            for (k=0; k<iDataSize-1; k++) { // no DRI or RSTn markers
+                if (pOut[k] == 0xff && (pOut[k+1] == 0xdd || (pOut[k+1] & 0xf8) == 0xd0)) break;
+            }
+            if (rc == JPEGE_SUCCESS && iDataSize == 11012 && k == iDataSize-1) { // 11076 with one per row
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, pOut, iDataSize, iTotal);
+    }
+    free(pOut);
+
+    // Test 29
+    iTotal++;
+    szTestName = (char *)"Test segment encoding and splicing";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    iOutputSize = 65536;
+    pOut = (uint8_t *)malloc(iOutputSize * 5); // serial output, spliced output and 3 segments
+    rc = jpg.open(pOut, iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        JPEGENC jpgSeg[3];
+        JPEGENCODE jpeSeg[3];
+        JPEGE_SEGMENT seg[3];
+        // reference: the same image encoded in one piece
+        rc = jpg.setRestartInterval(0, JPEGE_RESTART_MCUS);
+        rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+        rc |= jpg.addFrame(&jpe, (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch);
+        iDataSize = jpg.close();
+        k = iDataSize;
+        rc |= jpg.open(&pOut[iOutputSize], iOutputSize);
+        rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+        rc |= (jpgSeg[0].beginSegment(&jpg, &jpeSeg[0], &seg[0], 0, 1, &pOut[iOutputSize*2], iOutputSize) == JPEGE_UNSUPPORTED_FEATURE) ? JPEGE_SUCCESS : JPEGE_INVALID_PARAMETER; // needs no restarts
+        rc |= jpg.open(&pOut[iOutputSize], iOutputSize);
+        rc |= jpg.setRestartInterval(0, JPEGE_RESTART_MCUS);
+        rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+        if (rc == JPEGE_SUCCESS) {
+            for (x=0; x<3 && rc == JPEGE_SUCCESS; x++) { // these could each run on a separate thread
+                y = jpg.getMCUCount() * x / 3;
+                rc = jpgSeg[x].beginSegment(&jpg, &jpeSeg[x], &seg[x], y, jpg.getMCUCount() * (x+1) / 3 - y, &pOut[iOutputSize*(x+2)], iOutputSize);
+                if (rc == JPEGE_SUCCESS)
+                    rc = jpgSeg[x].addFrame(&jpeSeg[x], (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch);
+            }
+            if (rc == JPEGE_SUCCESS)
+                rc = jpg.spliceSegments(&jpe, seg, 3);
+            iDataSize = jpg.close();
+            if (rc == JPEGE_SUCCESS && iDataSize == 11012 && k == iDataSize && memcmp(pOut, &pOut[iOutputSize], k) == 0) {
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, &pOut[iOutputSize], iDataSize, iTotal);
+    }
+    free(pOut);
+
+    // Test 30
+    iTotal++;
+    szTestName = (char *)"Test growing the output buffer";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    iOutputSize = 1024; // far too small for the image
+    pOut = (uint8_t *)malloc(iOutputSize);
+    rc = jpg.open(pOut, iOutputSize);
+    if (rc == JPEGE_SUCCESS) {
+        rc = jpg.setGrowCallback(myGrow);
+        rc |= jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+        if (rc == JPEGE_SUCCESS) {
+            rc = jpg.addFrame(&jpe, (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch);
+            iDataSize = jpg.close();
+            pOut = jpg.getBuffer(); // it has moved
+            if (rc == JPEGE_SUCCESS && iDataSize == 11076) {
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, pOut, iDataSize, iTotal);
+    }
+    free(pOut);
+
+    // Test 31
+    iTotal++;
+    szTestName = (char *)"Test the worst case and predicted output sizes";
+    JPEGLOG(__LINE__, szTestName, szStart);
+    w = *(int32_t *)&rgb565[18];
+    h = *(int32_t *)&rgb565[22];
+    offset = *(int32_t *)&rgb565[10]; // offset to bits
+    pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+    d = (uint8_t *)malloc(JPEGE_PREDICT_WORK_SIZE);
+    iPredicted = jpg.predictSize(d, JPEGE_PREDICT_WORK_SIZE, (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH, 4);
+    if (jpg.predictSize(d, JPEGE_PREDICT_WORK_SIZE - 8, (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH, 4) != 0) {
+        iPredicted = -1; // the work area is too small
+    }
+    iOutputSize = jpg.maxEncodedSize(w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+    pOut = (uint8_t *)malloc(iOutputSize);
+    rc = jpg.open(pOut, iOutputSize);
+    if (rc == JPEGE_SUCCESS && jpg.predictSize(d, JPEGE_PREDICT_WORK_SIZE, (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH, 4) != iPredicted) {
+        iPredicted = -1; // the same with an opened encoder, which it doesn't touch
+    }
+    free(d);
+    if (rc == JPEGE_SUCCESS) {
+        rc = jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+        if (rc == JPEGE_SUCCESS) {
+            rc = jpg.addFrame(&jpe, (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch);
+            iDataSize = jpg.close();
+            // every 4th MCU predicts the size within 1%
+            if (rc == JPEGE_SUCCESS && iDataSize == 11076 && iOutputSize == 630636 && iPredicted == 10974) {
+                iTotalPass++;
+                JPEGLOG(__LINE__, szTestName, " - PASSED");
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            iTotalFail++;
+            JPEGLOG(__LINE__, szTestName, " - FAILED");
+        }
+    } else {
+        JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+    }
+    if (pRootName) {
+        SaveFile(pRootName, pOut, iDataSize, iTotal);
+    }
+    free(pOut);
+
+    if (pRootName) { // Test writing to the file callbacks
+        // Test 32
+        char szFile[256];
+        iTotal++;
+        snprintf(szFile, sizeof(szFile), "%s%d.jpg", pRootName, iTotal);
+        szTestName = (char *)"Test file output through a larger staging buffer";
+        JPEGLOG(__LINE__, szTestName, szStart);
+        w = *(int32_t *)&rgb565[18];
+        h = *(int32_t *)&rgb565[22];
+        offset = *(int32_t *)&rgb565[10]; // offset to bits
+        pitch = ((w * 2) + 3) & 0xfffc; // DWORD aligned
+        iOutputSize = 8192;
+        pOut = (uint8_t *)malloc(iOutputSize);
+        iWriteCount = 0;
+        rc = jpg.open(szFile, myOpen, myClose, myRead, myWrite, mySeek, pOut, 512); // too small
+        if (rc == JPEGE_INVALID_PARAMETER) {
+            rc = jpg.open(szFile, myOpen, myClose, myRead, myWrite, mySeek, pOut, iOutputSize);
+        } else {
+            rc = JPEGE_INVALID_PARAMETER;
+        }
+        if (rc == JPEGE_SUCCESS) {
+            rc = jpg.encodeBegin(&jpe, w, h, JPEGE_PIXEL_RGB565, JPEGE_SUBSAMPLE_420, JPEGE_Q_HIGH);
+            if (rc == JPEGE_SUCCESS) {
+                rc = jpg.addFrame(&jpe, (uint8_t *)&rgb565[offset + (h-1) * pitch], -pitch);
+                iDataSize = jpg.close();
+                // 2 writes instead of 8 with the built-in 2K buffer
+                if (rc == JPEGE_SUCCESS && iDataSize == 11076 && iWriteCount == 2) {
+                    iTotalPass++;
+                    JPEGLOG(__LINE__, szTestName, " - PASSED");
+                } else {
+                    iTotalFail++;
+                    JPEGLOG(__LINE__, szTestName, " - FAILED");
+                }
+            } else {
+                iTotalFail++;
+                JPEGLOG(__LINE__, szTestName, " - FAILED");
+            }
+        } else {
+            JPEGLOG(__LINE__, szTestName, "Error creating JPEG file.");
+        }
+        free(pOut);
+    }
+
     printf("Total tests: %d, %d passed, %d failed\n", iTotal, iTotalPass, iTotalFail);
     return 0;
 }
@@ -22,6 +22,13 @@
 
 #define CONVERT_TO_JPEG
 JPEGENC jpgenc;
+uint8_t ucPredictWork[JPEGE_PREDICT_WORK_SIZE]; // temporary encoder of predictSize()
+
+// Enlarge the output buffer if the predicted size wasn't enough
+uint8_t * myGrow(uint8_t *pBuffer, int32_t iNewSize)
+{
+    return (uint8_t *)ps_realloc(pBuffer, iNewSize);
+} /* myGrow() */
 
 void setup() {
     Serial.begin(115200);
@@ -62,13 +69,17 @@ void loop() {
         
         // Set JPEGENC's fastest input pixel format (YUV422)
         CoreS3.Camera.sensor->set_pixformat(CoreS3.Camera.sensor, PIXFORMAT_YUV422);
+        out_jpg_len2 = jpgenc.predictSize(ucPredictWork, sizeof(ucPredictWork), CoreS3.Camera.fb->buf, CoreS3.Camera.fb->width * 2, CoreS3.Camera.fb->width, CoreS3.Camera.fb->height, JPEGE_PIXEL_YUV422, JPEGE_SUBSAMPLE_420, JPEGE_Q_MED);
+        out_jpg_len2 += out_jpg_len2/4 + 1024; // margin for the estimate; maxEncodedSize() gives a hard limit
         l2 = millis();
-        out_jpg = (uint8_t *)ps_malloc(65536);
-        jpgenc.open(out_jpg, 65536);
+        out_jpg = (uint8_t *)ps_malloc(out_jpg_len2);
+        jpgenc.open(out_jpg, out_jpg_len2);
+        jpgenc.setGrowCallback(myGrow); // in case it was still too small
         jpgenc.encodeBegin(&enc, CoreS3.Camera.fb->width, CoreS3.Camera.fb->height, JPEGE_PIXEL_YUV422, JPEGE_SUBSAMPLE_420, JPEGE_Q_MED);
         jpgenc.addFrame(&enc, CoreS3.Camera.fb->buf, CoreS3.Camera.fb->width * 2);
         out_jpg_len2 = jpgenc.close();
         l2 = millis() - l2;
+        out_jpg = jpgenc.getBuffer(); // it may have moved
         free(out_jpg);
         Serial.printf("frame2jpg: %dms %d bytes, JPEGENC: %dms %d bytes\n", (int)l1, out_jpg_len1, (int)l2, out_jpg_len2);
 #else
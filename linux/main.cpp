@@ -9,15 +9,23 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "../src/JPEGENC.h"
 JPEGENC jpg; // static copy of JPEG encoder class
+uint8_t ucFileBuf[65536]; // stage the file output in large blocks (fewer write() calls)
 
 // If MEM_TO_MEM is defined, the encoder will output directly to a single buffer that you
-// supply. If the buffer isn't large enough, it will exit before completing the image.
+// supply. It's sized from predictSize() and grown with realloc() if that wasn't enough.
 // If MEM_TO_MEM is not defined, it will write the output incrementally to file I/O callback functions
 // that you provide.
 //#define MEM_TO_MEM
+#ifdef MEM_TO_MEM
+uint8_t ucPredictWork[JPEGE_PREDICT_WORK_SIZE]; // temporary encoder of predictSize()
+#endif
 
 //
 // File I/O callback functions
@@ -30,6 +38,11 @@ int32_t myWrite(JPEGE_FILE *pFile, uint8_t *pBuf, int32_t iLen)
     return (int32_t)fwrite(pBuf, 1, iLen, ohandle);
 } /* myWrite() */
 
+uint8_t * myGrow(uint8_t *pBuf, int32_t iNewSize)
+{
+    return (uint8_t *)realloc(pBuf, iNewSize);
+} /* myGrow() */
+
 int32_t myRead(JPEGE_FILE *pFile, uint8_t *pBuf, int32_t iLen)
 {
     FILE *ohandle = (FILE *)pFile->fHandle;
@@ -56,86 +69,76 @@ void myClose(JPEGE_FILE *pHandle)
 } /* myClose() */
 
 //
-// Read a Windows BMP file into memory
-// For this demo, the only supported files are 24 or 32-bits per pixel
+// Memory-map a Windows BMP file
+// For this demo, the only supported files are 24 or 32-bits per pixel and
+// 16-bits per pixel RGB565 (BI_BITFIELDS with masks 0xf800/0x07e0/0x001f);
+// the default 16-bit format (BI_RGB) is X1R5G5B5 and is rejected
+// Returns a pointer to the top line of pixels; bottom-up bitmaps are
+// described by a negative pitch so that the pixels can be encoded in place
 //
-uint8_t * ReadBMP(const char *fname, int *width, int *height, int *bpp, unsigned char *pPal)
+uint8_t * MapBMP(const char *fname, int *width, int *height, int *bpp, int *pitch, void **ppMap, size_t *pMapSize)
 {
-    int y, w, h, bits, offset;
-    uint8_t *s, *d, *pTemp, *pBitmap;
-    int pitch, bytewidth;
-    int iSize, iDelta;
-    FILE *infile;
+    int w, h, bits, offset, iPitch;
+    uint8_t *pFile, *pBits;
+    struct stat st;
+    int iHandle;
     
-    infile = fopen(fname, "r+b");
-    if (infile == NULL) {
+    iHandle = open(fname, O_RDONLY);
+    if (iHandle < 0) {
         printf("Error opening input file %s\n", fname);
         return NULL;
     }
-    // Read the bitmap into RAM
-    fseek(infile, 0, SEEK_END);
-    iSize = (int)ftell(infile);
-    fseek(infile, 0, SEEK_SET);
-    pBitmap = (uint8_t *)malloc(iSize);
-    pTemp = (uint8_t *)malloc(iSize);
-    fread(pTemp, 1, iSize, infile);
-    fclose(infile);
-    
-    if (pTemp[0] != 'B' || pTemp[1] != 'M' || pTemp[14] < 0x28) {
-        free(pBitmap);
-        free(pTemp);
+    if (fstat(iHandle, &st) != 0 || st.st_size < 54) {
+        close(iHandle);
+        printf("Not a Windows BMP file!\n");
+        return NULL;
+    }
+    pFile = (uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, iHandle, 0);
+    close(iHandle); // the mapping stays valid after closing the file
+    if (pFile == MAP_FAILED) {
+        printf("Error mapping input file %s\n", fname);
+        return NULL;
+    }
+    if (pFile[0] != 'B' || pFile[1] != 'M' || pFile[14] < 0x28) {
+        munmap(pFile, st.st_size);
         printf("Not a Windows BMP file!\n");
         return NULL;
     }
-    w = *(int32_t *)&pTemp[18];
-    h = *(int32_t *)&pTemp[22];
-    bits = *(int16_t *)&pTemp[26] * *(int16_t *)&pTemp[28];
-    if (bits <= 8) { // it has a palette, copy it
-        free(pBitmap);
-        free(pTemp);
-        return NULL; // only support 24/32-bpp for now
-//        uint8_t *p = pPal;
-//        for (int i=0; i<(1<<bits); i++)
-//        {
-//           *p++ = pTemp[54+i*4];
-//           *p++ = pTemp[55+i*4];
-//           *p++ = pTemp[56+i*4];
-//        }
+    w = *(int32_t *)&pFile[18];
+    h = *(int32_t *)&pFile[22];
+    bits = *(int16_t *)&pFile[26] * *(int16_t *)&pFile[28];
+    if (bits != 16 && bits != 24 && bits != 32) {
+        munmap(pFile, st.st_size);
+        return NULL; // only support 16/24/32-bpp for now
+    }
+    if (bits == 16 && (*(uint32_t *)&pFile[30] != 3 || st.st_size < 66 || *(uint32_t *)&pFile[54] != 0xf800 ||
+        *(uint32_t *)&pFile[58] != 0x07e0 || *(uint32_t *)&pFile[62] != 0x001f)) {
+        munmap(pFile, st.st_size);
+        return NULL; // only RGB565 (BI_BITFIELDS) for 16-bpp
     }
-    offset = *(int32_t *)&pTemp[10]; // offset to bits
-    bytewidth = (w * bits) >> 3;
-    pitch = (bytewidth + 3) & 0xfffc; // DWORD aligned
-// move up the pixels
-    d = pBitmap;
-    s = &pTemp[offset];
-    iDelta = pitch;
-    if (h > 0) {
-        iDelta = -pitch;
-        s = &pTemp[offset + (h-1) * pitch];
+    offset = *(int32_t *)&pFile[10]; // offset to bits
+    iPitch = (((w * bits) >> 3) + 3) & 0xfffc; // DWORD aligned
+    if (offset + iPitch * (h < 0 ? -h : h) > st.st_size) {
+        munmap(pFile, st.st_size);
+        printf("BMP file is truncated!\n");
+        return NULL;
+    }
+    pBits = &pFile[offset];
+    if (h > 0) { // bottom-up; start at the last line in memory and walk backwards
+        pBits += (h-1) * iPitch;
+        iPitch = -iPitch;
     } else {
         h = -h;
     }
-    for (y=0; y<h; y++) {
-        if (bits == 32) {// need to swap red and blue
-            for (int i=0; i<bytewidth; i+=4) {
-                d[i] = s[i+2];
-                d[i+1] = s[i+1];
-                d[i+2] = s[i];
-                d[i+3] = s[i+3];
-            }
-        } else {
-            memcpy(d, s, bytewidth);
-        }
-        d += bytewidth;
-        s += iDelta;
-    }
     *width = w;
     *height = h;
     *bpp = bits;
-    free(pTemp);
-    return pBitmap;
+    *pitch = iPitch;
+    *ppMap = pFile;
+    *pMapSize = st.st_size;
+    return pBits;
     
-} /* ReadBMP() */
+} /* MapBMP() */
 
 int main(int argc, const char * argv[]) {
 #ifdef MEM_TO_MEM
@@ -159,7 +162,7 @@ int main(int argc, const char * argv[]) {
         pBuffer = (uint8_t *)malloc(iSize);
         rc = jpg.open(pBuffer, iSize);
 #else // use incremental File I/O
-        rc = jpg.open(argv[1], myOpen, myClose, myRead, myWrite, mySeek);
+        rc = jpg.open(argv[1], myOpen, myClose, myRead, myWrite, mySeek, ucFileBuf, sizeof(ucFileBuf));
 #endif
         if (rc == JPEGE_SUCCESS) {
             rc = jpg.encodeBegin(&jpe, iWidth, iHeight, JPEGE_PIXEL_GRAYSCALE, JPEGE_SUBSAMPLE_444, JPEGE_Q_BEST);
@@ -187,27 +190,32 @@ int main(int argc, const char * argv[]) {
         }
     } else { // convert BMP file into JPEG
         uint8_t *pBitmap, ucPixelType;
-        int iBpp, iBytePP, iPitch;
-        pBitmap = ReadBMP(argv[1], &iWidth, &iHeight, &iBpp, NULL);
+        int iBpp, iPitch;
+        void *pMap;
+        size_t iMapSize;
+        pBitmap = MapBMP(argv[1], &iWidth, &iHeight, &iBpp, &iPitch, &pMap, &iMapSize);
         if (pBitmap == NULL)
         {
             fprintf(stderr, "Unable to open file: %s\n", argv[1]);
             return -1; // bad filename passed?
         }
-        if (iBpp == 24) {
-            iBytePP = 3;
-            ucPixelType = JPEGE_PIXEL_RGB888;
+        if (iBpp == 16) {
+            ucPixelType = JPEGE_PIXEL_RGB565;
+        } else if (iBpp == 24) {
+            ucPixelType = JPEGE_PIXEL_RGB888; // BMP byte order (B,G,R) is what the encoder expects
         } else { // must be 32-bpp
-            iBytePP = 4;
-            ucPixelType = JPEGE_PIXEL_ARGB8888;
+            ucPixelType = JPEGE_PIXEL_BGRA8888; // BMP byte order (B,G,R,A)
         }
-        iPitch = iBytePP * iWidth;
 #ifdef MEM_TO_MEM
-        iSize = (iWidth * iHeight * 3)/4; // guesstimate of the output size
+        iSize = jpg.predictSize(ucPredictWork, sizeof(ucPredictWork), pBitmap, iPitch, iWidth, iHeight, ucPixelType, JPEGE_SUBSAMPLE_420, JPEGE_Q_BEST);
+        iSize += iSize/4 + 1024; // margin for the estimate (use maxEncodedSize() for a hard limit)
         pBuffer = (uint8_t *)malloc(iSize);
         rc = jpg.open(pBuffer, iSize);
+        if (rc == JPEGE_SUCCESS) {
+            rc = jpg.setGrowCallback(myGrow); // in case the estimate was too low
+        }
 #else // use incremental File I/O
-        rc = jpg.open(argv[2], myOpen, myClose, myRead, myWrite, mySeek);
+        rc = jpg.open(argv[2], myOpen, myClose, myRead, myWrite, mySeek, ucFileBuf, sizeof(ucFileBuf));
 #endif
         if (rc == JPEGE_SUCCESS) {
             rc = jpg.encodeBegin(&jpe, iWidth, iHeight, ucPixelType, JPEGE_SUBSAMPLE_420, JPEGE_Q_BEST);
@@ -216,6 +224,7 @@ int main(int argc, const char * argv[]) {
                 iDataSize = jpg.close();
             }
 #ifdef MEM_TO_MEM
+            pBuffer = jpg.getBuffer(); // it may have been reallocated
             // We captured the compressed data in a buffer, so we need to
             // explicitly write it into a file
             oHandle = fopen(argv[2], "w+b");
@@ -225,8 +234,8 @@ int main(int argc, const char * argv[]) {
             }
             free(pBuffer);
 #endif
-            free(pBitmap);
         }
+        munmap(pMap, iMapSize);
     }
     return 0;
 } /* main() */
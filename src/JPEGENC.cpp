@@ -27,11 +27,14 @@
 //
 // File (SD/MMC) based initialization
 //
-int JPEGENC::open(const char *szFilename, JPEGE_OPEN_CALLBACK *pfnOpen, JPEGE_CLOSE_CALLBACK *pfnClose, JPEGE_READ_CALLBACK *pfnRead, JPEGE_WRITE_CALLBACK *pfnWrite, JPEGE_SEEK_CALLBACK *pfnSeek)
+int JPEGENC::open(const char *szFilename, JPEGE_OPEN_CALLBACK *pfnOpen, JPEGE_CLOSE_CALLBACK *pfnClose, JPEGE_READ_CALLBACK *pfnRead, JPEGE_WRITE_CALLBACK *pfnWrite, JPEGE_SEEK_CALLBACK *pfnSeek, uint8_t *pFileBuf, int iFileBufSize)
 {
     if (szFilename == NULL || pfnOpen == NULL || pfnClose == NULL || pfnRead == NULL || pfnWrite == NULL || pfnSeek == NULL) {
         return JPEGE_INVALID_PARAMETER;
     }
+    if (pFileBuf != NULL && iFileBufSize < 1024) {
+        return JPEGE_INVALID_PARAMETER;
+    }
     memset(&_jpeg, 0, sizeof(JPEGE_IMAGE));
     _jpeg.pfnRead = pfnRead;
     _jpeg.pfnWrite = pfnWrite;
@@ -39,7 +42,14 @@ int JPEGENC::open(const char *szFilename, JPEGE_OPEN_CALLBACK *pfnOpen, JPEGE_CL
     _jpeg.pfnOpen = pfnOpen;
     _jpeg.pfnClose = pfnClose;
     _jpeg.JPEGFile.fHandle = (*pfnOpen)(szFilename);
-    _jpeg.pHighWater = &_jpeg.ucFileBuf[JPEGE_FILE_BUF_SIZE - 512];
+    if (pFileBuf) {
+        _jpeg.pFileBuf = pFileBuf;
+        _jpeg.iFileBufSize = iFileBufSize;
+    } else {
+        _jpeg.pFileBuf = _jpeg.ucFileBuf;
+        _jpeg.iFileBufSize = JPEGE_FILE_BUF_SIZE;
+    }
+    _jpeg.pHighWater = &_jpeg.pFileBuf[_jpeg.iFileBufSize - 512];
     if (_jpeg.JPEGFile.fHandle == NULL) {
         _jpeg.iError = JPEGE_INVALID_FILE;
        return JPEGE_INVALID_FILE;
@@ -59,6 +69,97 @@ int JPEGENC::open(uint8_t *pOutput, int iBufferSize)
     return JPEGE_SUCCESS;
 } /* open() */
 
+int JPEGENC::setThumbnail(int iMaxSize, uint8_t *pWork, int iWorkSize)
+{
+    return JPEGSetThumbnail(&_jpeg, iMaxSize, pWork, iWorkSize);
+} /* setThumbnail() */
+
+int JPEGENC::setSampleBits(int iBits)
+{
+    return JPEGSetSampleBits(&_jpeg, iBits);
+} /* setSampleBits() */
+
+int JPEGENC::setToneMap(const uint8_t *pLUT)
+{
+    return JPEGSetToneMap(&_jpeg, pLUT);
+} /* setToneMap() */
+
+int JPEGENC::setAlphaEncoder(JPEGENC *pAlpha, JPEGENCODE *pAlphaEncode)
+{
+    return JPEGSetAlphaEncoder(&_jpeg, (pAlpha) ? &pAlpha->_jpeg : NULL, pAlphaEncode);
+} /* setAlphaEncoder() */
+
+int JPEGENC::setProgressive(uint8_t *pArena, int iArenaSize, const JPEGE_SCAN *pScans, int iScans)
+{
+    return JPEGSetProgressive(&_jpeg, pArena, iArenaSize, pScans, iScans);
+} /* setProgressive() */
+
+int JPEGENC::getProgressiveSize(int iWidth, int iHeight, uint8_t ucPixelType, uint8_t ucSubSample, uint8_t ucOrientation, uint8_t ucScale)
+{
+    return JPEGGetProgressiveSize(iWidth, iHeight, ucPixelType, ucSubSample, ucOrientation, ucScale);
+} /* getProgressiveSize() */
+
+int JPEGENC::setArithmetic(uint8_t *pWork, int iWorkSize)
+{
+    return JPEGSetArithmetic(&_jpeg, pWork, iWorkSize);
+} /* setArithmetic() */
+
+int JPEGENC::setTrellis(int iLambda)
+{
+    return JPEGSetTrellis(&_jpeg, iLambda);
+} /* setTrellis() */
+
+int JPEGENC::setDeadZone(int iComponent, int iDeadZone, int iIsolated)
+{
+    return JPEGSetDeadZone(&_jpeg, iComponent, iDeadZone, iIsolated);
+} /* setDeadZone() */
+
+int JPEGENC::setROI(const uint8_t *pMap, int iPitch)
+{
+    return JPEGSetROI(&_jpeg, pMap, iPitch);
+} /* setROI() */
+
+int JPEGENC::setRestartInterval(int iInterval, int iUnit)
+{
+    return JPEGSetRestartInterval(&_jpeg, iInterval, iUnit);
+} /* setRestartInterval() */
+
+int JPEGENC::maxEncodedSize(int iWidth, int iHeight, uint8_t ucPixelType, uint8_t ucSubSample, uint8_t ucQFactor, uint8_t ucOrientation, uint8_t ucScale, int iThumbMax)
+{
+    return JPEGMaxEncodedSize(iWidth, iHeight, ucPixelType, ucSubSample, ucQFactor, ucOrientation, ucScale, iThumbMax);
+} /* maxEncodedSize() */
+
+int JPEGENC::predictSize(uint8_t *pWork, int iWorkSize, uint8_t *pPixels, int iPitch, int iWidth, int iHeight, uint8_t ucPixelType, uint8_t ucSubSample, uint8_t ucQFactor, int iStep)
+{
+    return JPEGPredictSize(pWork, iWorkSize, pPixels, iPitch, iWidth, iHeight, ucPixelType, ucSubSample, ucQFactor, iStep);
+} /* predictSize() */
+
+int JPEGENC::beginSegment(JPEGENC *pMain, JPEGENCODE *pEncode, JPEGE_SEGMENT *pSegment, int iFirstMCU, int iMCUs, uint8_t *pBuffer, int iBufferSize)
+{
+    if (pMain == NULL) return JPEGE_INVALID_PARAMETER;
+    return JPEGSegmentBegin(&_jpeg, &pMain->_jpeg, pEncode, pSegment, iFirstMCU, iMCUs, pBuffer, iBufferSize);
+} /* beginSegment() */
+
+int JPEGENC::spliceSegments(JPEGENCODE *pEncode, JPEGE_SEGMENT *pSegments, int iCount)
+{
+    return JPEGSpliceSegments(&_jpeg, pEncode, pSegments, iCount);
+} /* spliceSegments() */
+
+int JPEGENC::setGrowCallback(JPEGE_GROW_CALLBACK *pfnGrow)
+{
+    return JPEGSetGrowCallback(&_jpeg, pfnGrow);
+} /* setGrowCallback() */
+
+uint8_t * JPEGENC::getBuffer()
+{
+    return _jpeg.pOutput;
+} /* getBuffer() */
+
+int JPEGENC::getMCUCount()
+{
+    return _jpeg.iMCUWidth * _jpeg.iMCUHeight;
+} /* getMCUCount() */
+
 //
 // return the last error (if any)
 //
@@ -77,9 +178,9 @@ int JPEGENC::close()
     return _jpeg.iDataSize;
 } /* close() */
 
-int JPEGENC::encodeBegin(JPEGENCODE *pEncode, int iWidth, int iHeight, uint8_t ucPixelType, uint8_t ucSubSample, uint8_t ucQFactor)
+int JPEGENC::encodeBegin(JPEGENCODE *pEncode, int iWidth, int iHeight, uint8_t ucPixelType, uint8_t ucSubSample, uint8_t ucQFactor, uint8_t ucOrientation, uint8_t ucScale)
 {
-    return JPEGEncodeBegin(&_jpeg, pEncode, iWidth, iHeight, ucPixelType, ucSubSample, ucQFactor);
+    return JPEGEncodeBegin(&_jpeg, pEncode, iWidth, iHeight, ucPixelType, ucSubSample, ucQFactor, ucOrientation, ucScale);
 } /* encodeBegin() */
 
 int JPEGENC::addMCU(JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch)
@@ -92,3 +193,22 @@ int JPEGENC::addFrame(JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch)
     return JPEGAddFrame(&_jpeg, pEncode, pPixels, iPitch);
 } /* addFrame() */
 
+int JPEGENC::addFrame(JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch, int x, int y, int w, int h)
+{
+    return JPEGAddFrameRect(&_jpeg, pEncode, pPixels, iPitch, x, y, w, h);
+} /* addFrame() */
+
+int JPEGENC::addFramePyramid(JPEGENCODE *pEncode, JPEGENC **pOthers, JPEGENCODE **pOtherEncodes, int iOthers, uint8_t *pPixels, int iPitch, uint8_t *pDCBuf, int iDCBufSize)
+{
+    JPEGE_IMAGE *pChildren[JPEGE_MAX_RENDITIONS];
+    int i;
+
+    if (iOthers < 0 || iOthers > JPEGE_MAX_RENDITIONS || (iOthers > 0 && pOthers == NULL)) {
+        _jpeg.iError = JPEGE_INVALID_PARAMETER;
+        return JPEGE_INVALID_PARAMETER;
+    }
+    for (i=0; i<iOthers; i++) {
+        pChildren[i] = &pOthers[i]->_jpeg;
+    }
+    return JPEGAddFramePyramid(&_jpeg, pEncode, pChildren, pOtherEncodes, iOthers, pPixels, iPitch, pDCBuf, iDCBufSize);
+} /* addFramePyramid() */
@@ -46,6 +46,11 @@
 
 /* Defines and variables */
 #define JPEGE_FILE_BUF_SIZE 2048
+#define JPEGE_MAX_RENDITIONS 8 // smaller images encoded along with addFramePyramid()
+#define JPEGE_THUMB_MAX_SIZE 160 // largest JFIF thumbnail width/height
+#define JPEGE_THUMB_OFFSET 20 // file offset of the thumbnail pixels in APP0
+#define JPEGE_THUMB_WORK_SIZE(iMaxSize) ((iMaxSize) * 3 * ((int)sizeof(uint16_t) + 1) + 1) // setThumbnail() work area: row sums and RGB row (+1 to align it)
+#define JPEGE_SCAN_ALL_COMPONENTS 0xff // progressive DC scan of all components
 
 #ifndef DCTSIZE
 #define DCTSIZE 64
@@ -108,7 +113,9 @@ enum {
 // Subsample types
 enum {
     JPEGE_SUBSAMPLE_444 = 0,
-    JPEGE_SUBSAMPLE_420
+    JPEGE_SUBSAMPLE_420,
+    JPEGE_SUBSAMPLE_422, // 16x8 MCUs, chroma halved horizontally only
+    JPEGE_SUBSAMPLE_400 // luma only; color sources are encoded as grayscale
 };
 
 // Pixel types
@@ -116,10 +123,51 @@ enum {
     JPEGE_PIXEL_GRAYSCALE = 0,
     JPEGE_PIXEL_RGB565,
     JPEGE_PIXEL_RGB888,
-    JPEGE_PIXEL_ARGB8888,
-    JPEGE_PIXEL_YUV422,
+    JPEGE_PIXEL_ARGB8888, // R,G,B,A byte order; the color encode ignores alpha, an alpha encoder (setAlphaEncoder()) uses it
+    JPEGE_PIXEL_RGBA8888 = JPEGE_PIXEL_ARGB8888,
+    JPEGE_PIXEL_YUV422, // packed 4:2:2: Y0 U Y1 V
+    JPEGE_PIXEL_YUYV = JPEGE_PIXEL_YUV422,
+    JPEGE_PIXEL_UYVY, // U Y0 V Y1
+    JPEGE_PIXEL_YVYU, // Y0 V Y1 U
+    JPEGE_PIXEL_VYUY, // V Y0 U Y1
+    JPEGE_PIXEL_RGB565_BE, // RGB565 with the high byte first (e.g. SPI displays/cameras)
+    JPEGE_PIXEL_BGR888, // R,G,B byte order (RGB888 is B,G,R)
+    JPEGE_PIXEL_BGRA8888, // B,G,R,A byte order (e.g. Windows/Linux 32-bpp bitmaps)
+    JPEGE_PIXEL_GRAY16, // 16-bit little-endian samples (see setSampleBits()/setToneMap())
+    JPEGE_PIXEL_RGB48, // R,G,B as 16-bit little-endian samples
+    JPEGE_PIXEL_I420, // planar 4:2:0: Y plane, then U and V planes (pitch/2)
+    JPEGE_PIXEL_NV12, // Y plane, then one plane of interleaved U/V (same pitch)
+    JPEGE_PIXEL_NV21, // Y plane, then one plane of interleaved V/U
+    JPEGE_PIXEL_BAYER_RGGB, // 8-bit raw sensor data, the first line starts with R,G
+    JPEGE_PIXEL_BAYER_BGGR,
+    JPEGE_PIXEL_BAYER_GRBG,
+    JPEGE_PIXEL_BAYER_GBRG,
+    JPEGE_PIXEL_BAYER16_RGGB, // 16-bit little-endian raw samples (see setSampleBits())
+    JPEGE_PIXEL_BAYER16_BGGR,
+    JPEGE_PIXEL_BAYER16_GRBG,
+    JPEGE_PIXEL_BAYER16_GBRG,
     JPEGE_PIXEL_COUNT
 };
+// Orientation applied to the source image while encoding
+enum {
+    JPEGE_ORIENT_NONE = 0,
+    JPEGE_ORIENT_ROT90, // rotate 90 degrees clockwise
+    JPEGE_ORIENT_ROT180,
+    JPEGE_ORIENT_ROT270, // rotate 90 degrees counter-clockwise
+    JPEGE_ORIENT_FLIPH, // mirror left/right
+    JPEGE_ORIENT_FLIPV, // mirror top/bottom
+    JPEGE_ORIENT_TRANSPOSE, // swap x/y (mirror across the main diagonal)
+    JPEGE_ORIENT_TRANSVERSE, // mirror across the anti-diagonal
+    JPEGE_ORIENT_COUNT
+};
+// Downscaling (box filter) applied to the source image while encoding
+enum {
+    JPEGE_SCALE_NONE = 0,
+    JPEGE_SCALE_HALF, // average each 2x2 block of source pixels
+    JPEGE_SCALE_QUARTER, // 4x4
+    JPEGE_SCALE_EIGHTH, // 8x8
+    JPEGE_SCALE_COUNT
+};
 // Compression quality
 enum {
     JPEGE_Q_BEST = 0,
@@ -127,6 +175,43 @@ enum {
     JPEGE_Q_MED,
     JPEGE_Q_LOW
 };
+// Unit of the restart interval (see setRestartInterval())
+enum {
+    JPEGE_RESTART_MCUS = 1,
+    JPEGE_RESTART_ROWS // MCU rows
+};
+
+// One scan of a progressive JPEG (see setProgressive())
+typedef struct jpege_scan_tag
+{
+    uint8_t ucComponent; // 0=Y, 1=Cb, 2=Cr or JPEGE_SCAN_ALL_COMPONENTS (DC scans only)
+    uint8_t ucSs, ucSe; // first and last coefficient (zigzag order); 0-0 for DC scans
+    uint8_t ucAh, ucAl; // successive approximation: previous and current bit position
+} JPEGE_SCAN;
+
+// Entropy-coded slice of an image made by a worker encoder (see beginSegment())
+typedef struct jpege_segment_tag
+{
+    uint8_t *pData; // the coded bits, most significant first, without 0xFF stuffing
+    int iBits; // number of valid bits in pData
+    int iFirstMCU, iMCUs; // range of MCUs in raster order
+    int iFirstDC[3]; // quantized DC value of the first block of each component
+    int iDCBit[3]; // bit offset of its DC code, which was coded against 0
+    int iLastDC[3]; // DC predictors at the end of the segment
+} JPEGE_SEGMENT;
+
+// State of the arithmetic (QM) coder for SOF9 output (see setArithmetic())
+typedef struct jpege_arith_tag
+{
+    int32_t c, a; // code and interval registers (T.81 Annex D)
+    int32_t iBuffer; // last output byte, held back for a carry (-1 = none)
+    int sc, zc, ct; // stacked 0xFF bytes, pending 0x00 bytes, bits until the next byte
+    int iDCContext[3]; // DC conditioning of each component
+    uint8_t ucDCStats[2][64]; // adaptive probability estimates of each table
+    uint8_t ucACStats[2][256];
+    uint8_t ucFixedBin; // fixed 0.5 estimate for the AC signs
+} JPEGE_ARITH;
+#define JPEGE_ARITH_WORK_SIZE ((int)sizeof(JPEGE_ARITH) + 3) // setArithmetic() work area (+3 to align it)
 
 typedef struct jpege_file_tag
 {
@@ -142,6 +227,9 @@ typedef int32_t (JPEGE_WRITE_CALLBACK)(JPEGE_FILE *pFile, uint8_t *pBuf, int32_t
 typedef int32_t (JPEGE_SEEK_CALLBACK)(JPEGE_FILE *pFile, int32_t iPosition);
 typedef void * (JPEGE_OPEN_CALLBACK)(const char *szFilename);
 typedef void (JPEGE_CLOSE_CALLBACK)(JPEGE_FILE *pFile);
+// Resize the output buffer to iNewSize bytes, keeping its contents (like
+// realloc); return the new buffer or NULL to fail with JPEGE_NO_BUFFER
+typedef uint8_t * (JPEGE_GROW_CALLBACK)(uint8_t *pBuffer, int32_t iNewSize);
 
 //
 // our private structure to hold a JPEG image encode state
@@ -151,9 +239,37 @@ typedef struct jpege_image_tag
     int iWidth, iHeight; // image size
     int iMCUWidth, iMCUHeight; // number of horizontal and vertical MCUs
     int x, y; // current MCU x/y
+    int iSrcWidth, iSrcHeight; // source image size (before rotation)
     uint8_t ucPixelType, ucSubSample, ucNumComponents;
+    uint8_t ucOrientation;
+    uint8_t ucScale; // log2 of the downscale factor
+    uint8_t ucPairOffset; // packed YUV crop starts on the second pixel of a pair
+    uint8_t ucThumbMax; // requested thumbnail size limit (0 = no thumbnail)
+    uint16_t *pThumbAcc; // Y/Cb/Cr sums of the current thumbnail row (caller's memory)
+    uint8_t ucSampleBits; // significant bits of 16-bit samples (0 = 16)
+    const uint8_t *pToneMap; // optional LUT from 16-bit samples to 8 bits
+    uint8_t ucAlphaPlane; // encode the alpha channel of a 32-bpp source as grayscale
+    struct jpege_image_tag *pAlpha; // optional encoder of the alpha channel
+    struct jpegencode_t *pAlphaEncode;
+    uint8_t *pProgArena; // caller's memory for progressive mode (NULL = baseline)
+    int iProgArenaSize;
+    const JPEGE_SCAN *pScans; // progressive scan script (NULL = default)
+    int iScans;
+    void *pProgWork; // Huffman optimization state at the start of the arena
+    signed short *pProgCoeffs[3]; // quantized blocks of each component
+    uint8_t ucArithmetic; // arithmetic coding (SOF9) instead of Huffman
+    JPEGE_ARITH *pArith; // its state, in the caller's memory
+    uint16_t usLambda; // rate-distortion trade-off of the trellis quantizer (0 = off)
+    uint8_t ucDeadZone[2]; // luma/chroma zero bin widening in 1/16ths of Q (0 = off)
+    uint8_t ucIsolated[2]; // luma/chroma zero run that makes a +/-1 AC coefficient noise (0 = off)
+    const uint8_t *pROIMap; // optional importance of each MCU (255 = full quality)
+    int iROIPitch; // bytes per row of MCUs in the importance map
+    uint8_t ucROIKeep, ucROIDeadZone; // zigzag coefficients kept and extra dead zone of the current MCU
+    uint8_t ucThumbWidth, ucThumbHeight, ucThumbShift; // thumbnail size and log2 of blocks per pixel
     uint8_t ucMemType;
     uint8_t *pOutput, *pHighWater;
+    uint8_t *pFileBuf; // file output is staged here (ucFileBuf or a larger one from the caller)
+    int iFileBufSize;
     int iBufferSize; // output buffer size provided by caller
     int iHeaderSize; // size of the JPEG header
     int iCompressedSize; // size of compressed output
@@ -161,20 +277,33 @@ typedef struct jpege_image_tag
     int iPitch; // bytes per line
     int iError;
     int iRestart; // current restart counter
+    uint16_t usRestartCount; // requested restart interval (0 = none)
+    uint8_t ucRestartUnit; // JPEGE_RESTART_MCUS/ROWS (0 = not set, one MCU row)
+    int iRestartMCUs; // restart interval in MCUs written to the DRI (0 = none)
+    int iRestartLeft; // MCUs left in the current restart interval
+    JPEGE_SEGMENT *pSegment; // the slice this worker encodes (NULL = whole image)
+    int iSegmentLeft; // MCUs left in the segment
+    uint8_t ucSegFirst; // components whose first DC code hasn't been seen yet
     int iDCPred0, iDCPred1, iDCPred2; // DC predictor values for the 3 color components
     PIL_CODE pc;
     int *huffdc[2];
     signed short sQuantTable[DCTSIZE*4];
     signed char MCUc[6*DCTSIZE]; // captured image data
     signed short MCUs[DCTSIZE]; // final processed output
+    uint8_t ucMCUTemp[16*16*6]; // gathered, padded or demosaiced source pixels of one MCU
+    uint8_t ucPixelTemp[16*16*3]; // 8-bit copy of 16-bit pixels or alpha values
+    signed char cSampleTemp[6*DCTSIZE]; // full resolution Y/Cb/Cr of a 4:2:2 MCU
+    signed short sDC[6]; // unquantized DC value of each block of the last MCU
     JPEGE_READ_CALLBACK *pfnRead;
     JPEGE_WRITE_CALLBACK *pfnWrite;
     JPEGE_SEEK_CALLBACK *pfnSeek;
     JPEGE_OPEN_CALLBACK *pfnOpen;
     JPEGE_CLOSE_CALLBACK *pfnClose;
+    JPEGE_GROW_CALLBACK *pfnGrow; // optional; enlarges the output buffer when it fills up
     JPEGE_FILE JPEGFile;
     uint8_t ucFileBuf[JPEGE_FILE_BUF_SIZE]; // holds temp file data
 } JPEGE_IMAGE;
+#define JPEGE_PREDICT_WORK_SIZE ((int)sizeof(JPEGE_IMAGE) + 7) // predictSize() work area (+7 to align it)
 
 typedef struct jpegencode_t
 {
@@ -190,12 +319,127 @@ typedef struct jpegencode_t
 class JPEGENC
 {
   public:
-    int open(const char *szFilename, JPEGE_OPEN_CALLBACK *pfnOpen, JPEGE_CLOSE_CALLBACK *pfnClose, JPEGE_READ_CALLBACK *pfnRead, JPEGE_WRITE_CALLBACK *pfnWrite, JPEGE_SEEK_CALLBACK *pfnSeek);
+    // pFileBuf/iFileBufSize optionally replace the built-in 2K staging buffer
+    // for file output (at least 1024 bytes); a larger one means fewer, larger
+    // writes. It must stay valid until close()
+    int open(const char *szFilename, JPEGE_OPEN_CALLBACK *pfnOpen, JPEGE_CLOSE_CALLBACK *pfnClose, JPEGE_READ_CALLBACK *pfnRead, JPEGE_WRITE_CALLBACK *pfnWrite, JPEGE_SEEK_CALLBACK *pfnSeek, uint8_t *pFileBuf = NULL, int iFileBufSize = 0);
     int open(uint8_t *pOutput, int iBufferSize);
     int close();
-    int encodeBegin(JPEGENCODE *pEncode, int iWidth, int iHeight, uint8_t ucPixelType, uint8_t ucSubSample, uint8_t ucQFactor);
+    // iWidth/iHeight are the source image size; the JPEG will be iHeight x iWidth
+    // when rotated by 90/270 degrees or transposed. Orientations other than NONE
+    // are only supported by addFrame() since they need access to the whole image
+    // The same goes for ucScale; the JPEG is then 1/2, 1/4 or 1/8 of the source
+    // size (rounded up) and each output pixel is the average of the source block
+    int encodeBegin(JPEGENCODE *pEncode, int iWidth, int iHeight, uint8_t ucPixelType, uint8_t ucSubSample, uint8_t ucQFactor, uint8_t ucOrientation = JPEGE_ORIENT_NONE, uint8_t ucScale = JPEGE_SCALE_NONE);
+    // iPitch can be negative for bottom-up images (e.g. Windows BMP); pPixels
+    // then points to the top line of the image, which is the last one in memory
+    // Planar YUV (I420/NV12/NV21) is only supported by addFrame(); the planes
+    // must follow each other in memory and the pitch must be positive (NV12/NV21
+    // need room for (width+1)/2 U/V pairs on each line)
+    // Bayer data is also addFrame() only (the demosaic needs the neighboring
+    // lines) and the pitch must be positive
     int addMCU(JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch);
     int addFrame(JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch);
+    // Encode the rectangle (x, y, w, h) of a larger image without copying it
+    // w and h must match the size passed to encodeBegin()
+    int addFrame(JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch, int x, int y, int w, int h);
+    // Encode this frame and smaller renditions of it (other JPEGENC objects
+    // started with the same source size and pixel type, but with a scale) in
+    // one pass over the source. A 1/8 size rendition can be made from the DC
+    // values of this one when a buffer of 24 bytes per pixel of its width
+    // (rounded up to a multiple of 16) is provided as pDCBuf
+    int addFramePyramid(JPEGENCODE *pEncode, JPEGENC **pOthers, JPEGENCODE **pOtherEncodes, int iOthers, uint8_t *pPixels, int iPitch, uint8_t *pDCBuf = NULL, int iDCBufSize = 0);
+    // Embed a raw RGB thumbnail (at most iMaxSize pixels wide and tall) in the
+    // JFIF header. It's made from the block averages of the encoded image, so
+    // it costs almost nothing (images up to 20480 pixels wide and tall).
+    // Writing to a file needs a working seek callback. pWork holds one row
+    // of the thumbnail until close(); it must be at least
+    // JPEGE_THUMB_WORK_SIZE(iMaxSize) bytes. Call after open() and before
+    // encodeBegin()
+    int setThumbnail(int iMaxSize, uint8_t *pWork, int iWorkSize);
+    // Number of significant bits (8-16) in 16-bit samples, e.g. 10 or 12 for
+    // unpacked raw sensor data. They're scaled down to 8 bits while sampling.
+    // Call after open() and before encodeBegin()
+    int setSampleBits(int iBits);
+    // Map 16-bit samples to 8 bits with a table (e.g. tone-mapping or gamma)
+    // instead of a shift. It needs an entry for each value of the number of
+    // bits set by setSampleBits() (65536 by default); NULL goes back to the
+    // shift. Call after open() and before encodeBegin()
+    int setToneMap(const uint8_t *pLUT);
+    // Encode the alpha channel of a RGBA8888/BGRA8888 source as a grayscale
+    // JPEG in another (opened) JPEGENC object while this one encodes the
+    // color. encodeBegin() starts both with the same size, quality,
+    // orientation and scale; addFrame() fills them in the same pass over the
+    // source. Close each one to finish its output. Call after open() and
+    // before encodeBegin()
+    int setAlphaEncoder(JPEGENC *pAlpha, JPEGENCODE *pAlphaEncode);
+    // Write a progressive (SOF2) JPEG. The quantized coefficients of the
+    // whole image are kept in pArena (see getProgressiveSize()) and the
+    // scans, each with its own optimal Huffman tables, are written by close().
+    // pScans is a custom scan script; NULL uses a default one with a DC scan,
+    // then AC bands with successive approximation. Call after open() and
+    // before encodeBegin()
+    int setProgressive(uint8_t *pArena, int iArenaSize, const JPEGE_SCAN *pScans = NULL, int iScans = 0);
+    // Arena size needed by setProgressive() for the same encodeBegin() options
+    int getProgressiveSize(int iWidth, int iHeight, uint8_t ucPixelType, uint8_t ucSubSample, uint8_t ucOrientation = JPEGE_ORIENT_NONE, uint8_t ucScale = JPEGE_SCALE_NONE);
+    // Use arithmetic coding (SOF9) instead of Huffman tables for smaller
+    // files; not every decoder supports it. The coder state is kept in pWork
+    // (JPEGE_ARITH_WORK_SIZE bytes) until close(); NULL goes back to Huffman.
+    // Call after open() and before encodeBegin(); not available for
+    // progressive output
+    int setArithmetic(uint8_t *pWork, int iWorkSize);
+    // Rate-distortion optimized (trellis) quantization for smaller files at
+    // the cost of encode time. Each AC coefficient may be lowered by one
+    // level or zeroed when the bits saved are worth more than the added
+    // error. iLambda is the squared error one bit is worth (0 = off, up to
+    // 65535); the size drops as it grows. Call before encodeBegin()
+    int setTrellis(int iLambda);
+    // Noise suppression for the quantizer, set separately for luma (0) and
+    // chroma (1). iDeadZone (0-8) widens the zero bin by 1/16ths of the
+    // quantizer step so weak AC coefficients become 0 instead of +/-1.
+    // iIsolated (0-63) drops +/-1 AC coefficients that have at least this
+    // many zeros on both sides in zigzag order. 0 turns each one off.
+    // Ignored when the trellis is enabled. Call before encodeBegin()
+    int setDeadZone(int iComponent, int iDeadZone, int iIsolated);
+    // Region of interest: pMap holds one importance byte per MCU of the
+    // output image, iPitch bytes per row of MCUs. 255 keeps the block as is;
+    // lower values drop the high frequencies and widen the dead zone, down
+    // to DC only at 0. NULL turns it off. Call before encodeBegin()
+    int setROI(const uint8_t *pMap, int iPitch);
+    // Restart markers every iInterval units (JPEGE_RESTART_MCUS or
+    // JPEGE_RESTART_ROWS). 0 leaves them out, which saves a few bytes per
+    // interval; shorter intervals limit the damage of transmission errors.
+    // The default is one MCU row. Call before encodeBegin()
+    int setRestartInterval(int iInterval, int iUnit);
+    // Largest possible size of the (baseline) JPEG for these options, e.g. to
+    // allocate an output buffer that can never be too small (it includes the
+    // 512 bytes kept free at the end). iThumbMax is the setThumbnail() size.
+    // Arithmetic and progressive output aren't covered
+    int maxEncodedSize(int iWidth, int iHeight, uint8_t ucPixelType, uint8_t ucSubSample, uint8_t ucQFactor, uint8_t ucOrientation = JPEGE_ORIENT_NONE, uint8_t ucScale = JPEGE_SCALE_NONE, int iThumbMax = 0);
+    // Estimate the JPEG size of an image from every iStep-th MCU with the
+    // default settings (a smaller step is slower, but closer). pPixels/iPitch are
+    // the same as for addFrame(). The sample is encoded in pWork, which must be
+    // at least JPEGE_PREDICT_WORK_SIZE bytes; this object isn't touched
+    int predictSize(uint8_t *pWork, int iWorkSize, uint8_t *pPixels, int iPitch, int iWidth, int iHeight, uint8_t ucPixelType, uint8_t ucSubSample, uint8_t ucQFactor, int iStep = 8);
+    // Parallel encoding: after pMain->encodeBegin() (without restart markers,
+    // a thumbnail, an alpha encoder or progressive/arithmetic output), any
+    // number of worker objects can each encode a range of iMCUs MCUs
+    // starting at iFirstMCU (raster order, see getMCUCount()) into their own
+    // buffer, e.g. on separate threads. The worker doesn't need open(); call
+    // addFrame() with the whole source image or addMCU() for each of its
+    // MCUs, and pSegment is filled in when the last one is done. Then
+    // pMain->spliceSegments() joins the segments, in order, into one stream
+    // and close() finishes the file as usual.
+    int beginSegment(JPEGENC *pMain, JPEGENCODE *pEncode, JPEGE_SEGMENT *pSegment, int iFirstMCU, int iMCUs, uint8_t *pBuffer, int iBufferSize);
+    int spliceSegments(JPEGENCODE *pEncode, JPEGE_SEGMENT *pSegments, int iCount);
+    int getMCUCount(); // total MCUs of the image after encodeBegin()
+    // Let the output buffer passed to open() grow instead of failing with
+    // JPEGE_NO_BUFFER. pfnGrow is called with a larger size (at least
+    // double) whenever the data gets near the end, so open() can start small.
+    // The buffer may move; getBuffer() returns where it is now. Call after
+    // open() and before encodeBegin()
+    int setGrowCallback(JPEGE_GROW_CALLBACK *pfnGrow);
+    uint8_t * getBuffer();
     int getLastError();
 
   private:
@@ -205,9 +449,28 @@ class JPEGENC
 #define JPEG_STATIC
 int JPEGOpenRAM(JPEGE_IMAGE *pJPEG, uint8_t *pData, int iDataSize);
 int JPEGOpenFile(JPEGE_IMAGE *pJPEG, const char *szFilename);
-int JPEGEncodeBegin(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, int iWidth, int iHeight, uint8_t ucPixelType, uint8_t ucSubSample, uint8_t ucQFactor);
+int JPEGEncodeBegin(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, int iWidth, int iHeight, uint8_t ucPixelType, uint8_t ucSubSample, uint8_t ucQFactor, uint8_t ucOrientation, uint8_t ucScale);
 int JPEGEncodeEnd(JPEGE_IMAGE *pJPEG);
 int JPEGAddMCU(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch);
+int JPEGAddFrame(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch);
+int JPEGAddFrameRect(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch, int x, int y, int w, int h);
+int JPEGAddFramePyramid(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, JPEGE_IMAGE **pChildren, JPEGENCODE **pChildEncodes, int iChildren, uint8_t *pPixels, int iPitch, uint8_t *pDCBuf, int iDCBufSize);
+int JPEGSetThumbnail(JPEGE_IMAGE *pJPEG, int iMaxSize, uint8_t *pWork, int iWorkSize);
+int JPEGSetSampleBits(JPEGE_IMAGE *pJPEG, int iBits);
+int JPEGSetToneMap(JPEGE_IMAGE *pJPEG, const uint8_t *pLUT);
+int JPEGSetAlphaEncoder(JPEGE_IMAGE *pJPEG, JPEGE_IMAGE *pAlpha, JPEGENCODE *pAlphaEncode);
+int JPEGSetProgressive(JPEGE_IMAGE *pJPEG, uint8_t *pArena, int iArenaSize, const JPEGE_SCAN *pScans, int iScans);
+int JPEGGetProgressiveSize(int iWidth, int iHeight, uint8_t ucPixelType, uint8_t ucSubSample, uint8_t ucOrientation, uint8_t ucScale);
+int JPEGSetArithmetic(JPEGE_IMAGE *pJPEG, uint8_t *pWork, int iWorkSize);
+int JPEGSetTrellis(JPEGE_IMAGE *pJPEG, int iLambda);
+int JPEGSetDeadZone(JPEGE_IMAGE *pJPEG, int iComponent, int iDeadZone, int iIsolated);
+int JPEGSetROI(JPEGE_IMAGE *pJPEG, const uint8_t *pMap, int iPitch);
+int JPEGSetRestartInterval(JPEGE_IMAGE *pJPEG, int iInterval, int iUnit);
+int JPEGMaxEncodedSize(int iWidth, int iHeight, uint8_t ucPixelType, uint8_t ucSubSample, uint8_t ucQFactor, uint8_t ucOrientation, uint8_t ucScale, int iThumbMax);
+int JPEGPredictSize(uint8_t *pWork, int iWorkSize, uint8_t *pPixels, int iPitch, int iWidth, int iHeight, uint8_t ucPixelType, uint8_t ucSubSample, uint8_t ucQFactor, int iStep);
+int JPEGSetGrowCallback(JPEGE_IMAGE *pJPEG, JPEGE_GROW_CALLBACK *pfnGrow);
+int JPEGSegmentBegin(JPEGE_IMAGE *pJPEG, JPEGE_IMAGE *pMain, JPEGENCODE *pEncode, JPEGE_SEGMENT *pSegment, int iFirstMCU, int iMCUs, uint8_t *pBuffer, int iBufferSize);
+int JPEGSpliceSegments(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, JPEGE_SEGMENT *pSegments, int iCount);
 int JPEGGetLastError(JPEGE_IMAGE *pJPEG);
 #endif // __cplusplus
 
@@ -668,6 +668,98 @@ const uint8_t hufftable[] PROGMEM = {
     0x10,0x00,0x10,0x00,0x10,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
     0x0a,0x00,0x0f,0x00,0x10,0x00,0x10,0x00,0x10,0x00,0x10,0x00,0x10,0x00,0x10,0x00,
     0x10,0x00,0x10,0x00,0x10,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00};
+// Source coordinates of each output pixel (u,v) for the orientation options
+// sx = (flipx ? width-1 : 0) + u*xu + v*xv, sy = (flipy ? height-1 : 0) + u*yu + v*yv
+// {xu, xv, yu, yv, flipx, flipy}
+const signed char cOrientXForm[JPEGE_ORIENT_COUNT][6] PROGMEM = {
+    {1, 0, 0, 1, 0, 0}, // NONE
+    {0, 1, -1, 0, 0, 1}, // ROT90
+    {-1, 0, 0, -1, 1, 1}, // ROT180
+    {0, -1, 1, 0, 1, 0}, // ROT270
+    {-1, 0, 0, 1, 1, 0}, // FLIPH
+    {1, 0, 0, -1, 0, 1}, // FLIPV
+    {0, 1, 1, 0, 0, 0}, // TRANSPOSE
+    {0, -1, -1, 0, 1, 1}}; // TRANSVERSE
+// Bytes per pixel of each source pixel type
+// (YUV422 is 4 bytes for each horizontal pair of pixels)
+// (planar types only count the Y plane)
+const uint8_t ucPixelBytes[JPEGE_PIXEL_COUNT] PROGMEM = {1, 2, 3, 4, 2, 2, 2, 2, 2, 3, 4, 2, 6, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2};
+// Offsets of Y0, U and V in each 4-byte pair of the packed 4:2:2 types
+// (Y1 always follows 2 bytes after Y0)
+const uint8_t ucYUVOffsets[4][3] PROGMEM = {
+    {0, 1, 3}, // YUYV (YUV422)
+    {1, 0, 2}, // UYVY
+    {0, 3, 1}, // YVYU
+    {1, 2, 0}}; // VYUY
+// Color (0=R, 1=G, 2=B) of each site of a 2x2 Bayer cell for the 4 patterns
+const uint8_t ucBayerColors[4][4] PROGMEM = {
+    {0, 1, 1, 2}, // RGGB
+    {2, 1, 1, 0}, // BGGR
+    {1, 0, 2, 1}, // GRBG
+    {1, 2, 0, 1}}; // GBRG
+#define JPEGE_IS_PACKED422(t) ((t) >= JPEGE_PIXEL_YUV422 && (t) <= JPEGE_PIXEL_VYUY)
+//
+// Progressive mode: the quantized blocks of the whole image are kept in the
+// caller's arena and the scans are encoded from there by JPEGEncodeEnd().
+// Each scan is done twice; first to count the symbols and then to write them
+// with the optimal Huffman tables built from the counts.
+//
+#define JPEGE_MAX_CORR_BITS 1000 // buffered refinement bits before a forced EOB run
+typedef struct jpege_prog_work_tag
+{
+    uint32_t ulFreq[2][257]; // symbol counts (+1 reserved symbol) of the current scan
+    uint16_t usCode[2][256]; // Huffman codes built from the counts
+    uint8_t ucCodeLen[2][256];
+    uint8_t ucBits[2][16]; // DHT contents (codes of each length and the symbols)
+    uint8_t ucVals[2][256];
+    uint8_t ucCorrBits[JPEGE_MAX_CORR_BITS]; // correction bits waiting for an EOB run
+    int iLastDC[3];
+    int iEOBRun, iBE; // pending EOB run and buffered correction bits
+    int bGather; // counting symbols instead of writing them
+} JPEGE_PROG_WORK;
+// Default scan scripts (similar to the libjpeg "simple progression")
+const JPEGE_SCAN scanColor[10] PROGMEM = {
+    {JPEGE_SCAN_ALL_COMPONENTS, 0, 0, 0, 1},
+    {0, 1, 5, 0, 2},
+    {2, 1, 63, 0, 1},
+    {1, 1, 63, 0, 1},
+    {0, 6, 63, 0, 2},
+    {0, 1, 63, 2, 1},
+    {JPEGE_SCAN_ALL_COMPONENTS, 0, 0, 1, 0},
+    {2, 1, 63, 1, 0},
+    {1, 1, 63, 1, 0},
+    {0, 1, 63, 1, 0}};
+const JPEGE_SCAN scanGray[6] PROGMEM = {
+    {0, 0, 0, 0, 1},
+    {0, 1, 5, 0, 2},
+    {0, 6, 63, 0, 2},
+    {0, 1, 63, 2, 1},
+    {0, 0, 0, 1, 0},
+    {0, 1, 63, 1, 0}};
+// QM-coder probability estimates (T.81 Table D.2); Qe in the upper 16 bits,
+// then the next index after an MPS, the MPS switch (bit 7) and the next index
+// after an LPS. The extra last entry is a fixed estimate of 0.5
+const uint32_t ulArithQe[114] PROGMEM = {
+    0x5a1d0181, 0x2586020e, 0x11140310, 0x080b0412, 0x03d80514, 0x01da0617,
+    0x00e50719, 0x006f081c, 0x0036091e, 0x001a0a21, 0x000d0b23, 0x00060c09,
+    0x00030d0a, 0x00010d0c, 0x5a7f0f8f, 0x3f251024, 0x2cf21126, 0x207c1227,
+    0x17b91328, 0x1182142a, 0x0cef152b, 0x09a1162d, 0x072f172e, 0x055c1830,
+    0x04061931, 0x03031a33, 0x02401b34, 0x01b11c36, 0x01441d38, 0x00f51e39,
+    0x00b71f3b, 0x008a203c, 0x0068213e, 0x004e223f, 0x003b2320, 0x002c0921,
+    0x5ae125a5, 0x484c2640, 0x3a0d2741, 0x2ef12843, 0x261f2944, 0x1f332a45,
+    0x19a82b46, 0x15182c48, 0x11772d49, 0x0e742e4a, 0x0bfb2f4b, 0x09f8304d,
+    0x0861314e, 0x0706324f, 0x05cd3330, 0x04de3432, 0x040f3532, 0x03633633,
+    0x02d43734, 0x025c3835, 0x01f83936, 0x01a43a37, 0x01603b38, 0x01253c39,
+    0x00f63d3a, 0x00cb3e3b, 0x00ab3f3d, 0x008f203d, 0x5b1241c1, 0x4d044250,
+    0x412c4351, 0x37d84452, 0x2fe84553, 0x293c4654, 0x23794756, 0x1edf4857,
+    0x1aa94957, 0x174e4a48, 0x14244b48, 0x119c4c4a, 0x0f6b4d4a, 0x0d514e4b,
+    0x0bb64f4d, 0x0a40304d, 0x583251d0, 0x4d1c5258, 0x438e5359, 0x3bdd545a,
+    0x34ee555b, 0x2eae565c, 0x299a575d, 0x25164756, 0x557059d8, 0x4ca95a5f,
+    0x44d95b60, 0x3e225c61, 0x38245d63, 0x32b45e63, 0x2e17565d, 0x56a860df,
+    0x4f466165, 0x47e56266, 0x41cf6367, 0x3c3d6468, 0x375e5d63, 0x52316669,
+    0x4c0f676a, 0x4639686b, 0x415e6367, 0x56276ae9, 0x50e76b6c, 0x4b85676d,
+    0x55976d6e, 0x504f6b6f, 0x5a106fee, 0x55226d70, 0x59eb6ff0, 0x5a1d7171};
+
 void JPEGFixQuantE(JPEGE_IMAGE *pJPEG)
 {
     int iTable, iTableOffset;
@@ -796,18 +888,668 @@ void JPEGMakeHuffE(JPEGE_IMAGE *pJPEG)
 #endif // USE_RAM_FOR_TABLES
 } /* JPEGMakeHuffE() */
 //
+// Sampling factors of a component (only Y is ever subsampled)
+//
+int JPEGProgH(JPEGE_IMAGE *pJPEG, int iComp)
+{
+    return (iComp == 0 && pJPEG->ucNumComponents == 3 && pJPEG->ucSubSample != JPEGE_SUBSAMPLE_444) ? 2 : 1;
+} /* JPEGProgH() */
+
+int JPEGProgV(JPEGE_IMAGE *pJPEG, int iComp)
+{
+    return (iComp == 0 && pJPEG->ucNumComponents == 3 && pJPEG->ucSubSample == JPEGE_SUBSAMPLE_420) ? 2 : 1;
+} /* JPEGProgV() */
+//
+// Ask the caller for a larger output buffer (see JPEGSetGrowCallback)
+// iNeeded is the number of bytes about to be written at pc.pOut
+//
+int JPEGGrowOutput(JPEGE_IMAGE *pJPEG, int iNeeded)
+{
+    uint8_t *pNew;
+    int iSize, iUsed = (int)(pJPEG->pc.pOut - pJPEG->pOutput);
+
+    iSize = iUsed + iNeeded + 512; // keep the usual margin above the high water mark
+    if (iSize < pJPEG->iBufferSize * 2)
+        iSize = pJPEG->iBufferSize * 2; // grow geometrically
+    if (pJPEG->pfnGrow == NULL || pJPEG->iBufferSize > 0x3fffffff || (pNew = pJPEG->pfnGrow(pJPEG->pOutput, iSize)) == NULL) {
+        pJPEG->iError = JPEGE_NO_BUFFER;
+        return JPEGE_NO_BUFFER;
+    }
+    pJPEG->pc.pOut = &pNew[iUsed];
+    pJPEG->pOutput = pNew;
+    pJPEG->iBufferSize = iSize;
+    pJPEG->pHighWater = &pNew[iSize - 512];
+    return JPEGE_SUCCESS;
+} /* JPEGGrowOutput() */
+//
+// Make room for iNeeded more bytes of progressive output
+// (writes the buffered data to the file or grows the buffer)
+//
+int JPEGProgCheckOutput(JPEGE_IMAGE *pJPEG, int iNeeded)
+{
+    if (pJPEG->pc.pOut + iNeeded > pJPEG->pHighWater) {
+        if (pJPEG->pOutput) { // the user-supplied buffer is not big enough
+            return JPEGGrowOutput(pJPEG, iNeeded);
+        } else { // write current block of data
+            int iLen = (int)(pJPEG->pc.pOut - pJPEG->pFileBuf);
+            pJPEG->pfnWrite(&pJPEG->JPEGFile, pJPEG->pFileBuf, iLen);
+            pJPEG->iDataSize += iLen;
+            pJPEG->pc.pOut = pJPEG->pFileBuf;
+        }
+    }
+    return JPEGE_SUCCESS;
+} /* JPEGProgCheckOutput() */
+//
+// Write up to 16 bits to the output
+//
+void JPEGProgPutBits(JPEGE_IMAGE *pJPEG, uint32_t ulBits, int iBitCount)
+{
+    unsigned char *pOut;
+    BIGUINT ulAcc, ulCode, iLen, iNewLen;
+
+    if (pJPEG->iError != JPEGE_SUCCESS || JPEGProgCheckOutput(pJPEG, 16) != JPEGE_SUCCESS)
+        return;
+    pOut = pJPEG->pc.pOut;
+    ulAcc = pJPEG->pc.ulAcc;
+    iLen = pJPEG->pc.iLen;
+    ulCode = ulBits & ((1 << iBitCount) - 1);
+    iNewLen = iBitCount;
+    STORECODE(pOut, iLen, ulCode, ulAcc, iNewLen)
+    pJPEG->pc.pOut = pOut;
+    pJPEG->pc.ulAcc = ulAcc;
+    pJPEG->pc.iLen = iLen;
+} /* JPEGProgPutBits() */
+//
+// Pad the last byte of a scan with 1 bits and write out the accumulator
+//
+void JPEGProgFlush(JPEGE_IMAGE *pJPEG)
+{
+    unsigned char c;
+
+    if (pJPEG->pc.iLen & 7)
+        JPEGProgPutBits(pJPEG, 0xff, 8 - (int)(pJPEG->pc.iLen & 7));
+    if (pJPEG->iError != JPEGE_SUCCESS)
+        return;
+    while (pJPEG->pc.iLen > 0) {
+        c = (unsigned char)(pJPEG->pc.ulAcc >> (REGISTER_WIDTH-8));
+        *pJPEG->pc.pOut++ = c;
+        if (c == 0xff) // stuffed 0
+            *pJPEG->pc.pOut++ = 0;
+        pJPEG->pc.ulAcc <<= 8;
+        pJPEG->pc.iLen -= 8;
+    }
+    pJPEG->pc.iLen = 0;
+    pJPEG->pc.ulAcc = 0;
+} /* JPEGProgFlush() */
+//
+// Count or write a Huffman coded symbol
+//
+void JPEGProgSymbol(JPEGE_IMAGE *pJPEG, JPEGE_PROG_WORK *pWork, int iTable, int iSymbol)
+{
+    if (pWork->bGather)
+        pWork->ulFreq[iTable][iSymbol]++;
+    else
+        JPEGProgPutBits(pJPEG, pWork->usCode[iTable][iSymbol], pWork->ucCodeLen[iTable][iSymbol]);
+} /* JPEGProgSymbol() */
+
+void JPEGProgBits(JPEGE_IMAGE *pJPEG, JPEGE_PROG_WORK *pWork, int iBits, int iCount)
+{
+    if (!pWork->bGather && iCount)
+        JPEGProgPutBits(pJPEG, (uint32_t)iBits, iCount);
+} /* JPEGProgBits() */
+
+void JPEGProgCorrBits(JPEGE_IMAGE *pJPEG, JPEGE_PROG_WORK *pWork, uint8_t *pBits, int iCount)
+{
+    int i;
+
+    if (pWork->bGather)
+        return;
+    for (i=0; i<iCount; i++)
+        JPEGProgPutBits(pJPEG, pBits[i], 1);
+} /* JPEGProgCorrBits() */
+//
+// Write the pending run of empty blocks (and their correction bits)
+//
+void JPEGProgEOBRun(JPEGE_IMAGE *pJPEG, JPEGE_PROG_WORK *pWork)
+{
+    int i, iBits = 0;
+
+    if (pWork->iEOBRun == 0)
+        return;
+    for (i = pWork->iEOBRun; i > 1; i >>= 1)
+        iBits++;
+    JPEGProgSymbol(pJPEG, pWork, 0, iBits << 4);
+    JPEGProgBits(pJPEG, pWork, pWork->iEOBRun, iBits);
+    pWork->iEOBRun = 0;
+    JPEGProgCorrBits(pJPEG, pWork, pWork->ucCorrBits, pWork->iBE);
+    pWork->iBE = 0;
+} /* JPEGProgEOBRun() */
+//
+// Encode (or count the symbols of) one block for the current scan
+// This follows the four cases of Annex G: DC first/refine and AC first/refine
+//
+void JPEGProgBlock(JPEGE_IMAGE *pJPEG, JPEGE_PROG_WORK *pWork, const JPEGE_SCAN *pScan, int iComp, signed short *pBlock)
+{
+    int k, r, t, t2, iBits, iEOB, iBR;
+    int iAbs[DCTSIZE];
+    uint8_t *pBR;
+    const int iAl = pScan->ucAl;
+
+    if (pScan->ucSs == 0) { // DC
+        t = pBlock[0] >> iAl;
+        if (pScan->ucAh) { // refinement: just the next bit
+            JPEGProgBits(pJPEG, pWork, t & 1, 1);
+            return;
+        }
+        t2 = t - pWork->iLastDC[iComp];
+        pWork->iLastDC[iComp] = t;
+        t = (t2 < 0) ? -t2 : t2;
+        for (iBits = 0; t; t >>= 1)
+            iBits++;
+        JPEGProgSymbol(pJPEG, pWork, (iComp) ? 1 : 0, iBits);
+        if (t2 < 0) t2--;
+        JPEGProgBits(pJPEG, pWork, t2, iBits);
+        return;
+    }
+    if (pScan->ucAh == 0) { // first pass over this band
+        r = 0;
+        for (k = pScan->ucSs; k <= pScan->ucSe; k++) {
+            t = pBlock[cZigZag2[k]];
+            if (t < 0) {
+                t = (-t) >> iAl;
+                t2 = ~t;
+            } else {
+                t >>= iAl;
+                t2 = t;
+            }
+            if (t == 0) {
+                r++;
+                continue;
+            }
+            JPEGProgEOBRun(pJPEG, pWork);
+            while (r > 15) {
+                JPEGProgSymbol(pJPEG, pWork, 0, 0xf0); // ZRL
+                r -= 16;
+            }
+            for (iBits = 1; (t >>= 1); iBits++) {};
+            JPEGProgSymbol(pJPEG, pWork, 0, (r << 4) + iBits);
+            JPEGProgBits(pJPEG, pWork, t2, iBits);
+            r = 0;
+        }
+        if (r > 0) { // the rest of the band is empty
+            if (++pWork->iEOBRun == 0x7fff)
+                JPEGProgEOBRun(pJPEG, pWork);
+        }
+        return;
+    }
+    // AC refinement; coefficients which were already non-zero get a correction
+    // bit, new ones (now +/-1) are coded like the first pass
+    iEOB = 0;
+    for (k = pScan->ucSs; k <= pScan->ucSe; k++) {
+        t = pBlock[cZigZag2[k]];
+        if (t < 0) t = -t;
+        t >>= iAl;
+        iAbs[k] = t;
+        if (t == 1) iEOB = k; // last newly non-zero coefficient
+    }
+    r = iBR = 0;
+    pBR = &pWork->ucCorrBits[pWork->iBE];
+    for (k = pScan->ucSs; k <= pScan->ucSe; k++) {
+        t = iAbs[k];
+        if (t == 0) {
+            r++;
+            continue;
+        }
+        while (r > 15 && k <= iEOB) {
+            JPEGProgEOBRun(pJPEG, pWork);
+            JPEGProgSymbol(pJPEG, pWork, 0, 0xf0); // ZRL
+            r -= 16;
+            JPEGProgCorrBits(pJPEG, pWork, pBR, iBR);
+            pBR = pWork->ucCorrBits; // the older bits were written by JPEGProgEOBRun()
+            iBR = 0;
+        }
+        if (t > 1) { // already non-zero; just buffer the correction bit
+            pBR[iBR++] = (uint8_t)(t & 1);
+            continue;
+        }
+        JPEGProgEOBRun(pJPEG, pWork);
+        JPEGProgSymbol(pJPEG, pWork, 0, (r << 4) + 1);
+        JPEGProgBits(pJPEG, pWork, (pBlock[cZigZag2[k]] < 0) ? 0 : 1, 1);
+        JPEGProgCorrBits(pJPEG, pWork, pBR, iBR);
+        pBR = pWork->ucCorrBits;
+        iBR = r = 0;
+    }
+    if (r > 0 || iBR > 0) { // end of band; the correction bits wait for the EOB run
+        pWork->iEOBRun++;
+        pWork->iBE += iBR;
+        if (pWork->iEOBRun == 0x7fff || pWork->iBE > JPEGE_MAX_CORR_BITS - DCTSIZE + 1)
+            JPEGProgEOBRun(pJPEG, pWork);
+    }
+} /* JPEGProgBlock() */
+//
+// Visit the blocks of a scan in the order they are stored in the file
+//
+void JPEGProgScanPass(JPEGE_IMAGE *pJPEG, JPEGE_PROG_WORK *pWork, const JPEGE_SCAN *pScan)
+{
+    int c, x, y, h, v, iH, iV, iPitch, iCols, iRows;
+
+    pWork->iEOBRun = pWork->iBE = 0;
+    pWork->iLastDC[0] = pWork->iLastDC[1] = pWork->iLastDC[2] = 0;
+    if (pScan->ucComponent == JPEGE_SCAN_ALL_COMPONENTS && pJPEG->ucNumComponents == 3) {
+        // interleaved DC scan; whole MCUs, including the padding blocks
+        for (y=0; y<pJPEG->iMCUHeight && pJPEG->iError == JPEGE_SUCCESS; y++) {
+            for (x=0; x<pJPEG->iMCUWidth; x++) {
+                for (c=0; c<3; c++) {
+                    iH = JPEGProgH(pJPEG, c);
+                    iV = JPEGProgV(pJPEG, c);
+                    iPitch = pJPEG->iMCUWidth * iH;
+                    for (v=0; v<iV; v++) {
+                        for (h=0; h<iH; h++) {
+                            JPEGProgBlock(pJPEG, pWork, pScan, c, &pJPEG->pProgCoeffs[c][((y*iV + v) * iPitch + x*iH + h) * DCTSIZE]);
+                        }
+                    }
+                } // for c
+            } // for x
+        } // for y
+    } else { // a single component only covers the blocks inside the image
+        c = (pScan->ucComponent == JPEGE_SCAN_ALL_COMPONENTS) ? 0 : pScan->ucComponent;
+        iH = JPEGProgH(pJPEG, c);
+        iV = JPEGProgV(pJPEG, c);
+        iPitch = pJPEG->iMCUWidth * iH;
+        iCols = ((pJPEG->iWidth * iH + JPEGProgH(pJPEG, 0) - 1) / JPEGProgH(pJPEG, 0) + 7) >> 3;
+        iRows = ((pJPEG->iHeight * iV + JPEGProgV(pJPEG, 0) - 1) / JPEGProgV(pJPEG, 0) + 7) >> 3;
+        for (y=0; y<iRows && pJPEG->iError == JPEGE_SUCCESS; y++) {
+            for (x=0; x<iCols; x++) {
+                JPEGProgBlock(pJPEG, pWork, pScan, c, &pJPEG->pProgCoeffs[c][(y * iPitch + x) * DCTSIZE]);
+            }
+        }
+    }
+    JPEGProgEOBRun(pJPEG, pWork);
+} /* JPEGProgScanPass() */
+//
+// Build an optimal Huffman table from the symbol counts (JPEG Annex K.2)
+// Returns the number of symbols
+//
+int JPEGProgMakeTable(uint32_t *pFreq, uint8_t *pBits, uint8_t *pVals, uint16_t *pCode, uint8_t *pCodeLen)
+{
+    short sCodeSize[257], sOthers[257];
+    int iBits[258];
+    int i, j, c1, c2, iCount, iCode;
+    uint32_t v;
+
+    for (i=0; i<257; i++) {
+        sCodeSize[i] = 0;
+        sOthers[i] = -1;
+    }
+    memset(iBits, 0, sizeof(iBits));
+    pFreq[256] = 1; // reserved, so that no code is all 1 bits
+    for (;;) {
+        // merge the two least frequent trees; ties go to the larger symbol
+        c1 = c2 = -1;
+        v = 0xffffffff;
+        for (i=0; i<=256; i++) {
+            if (pFreq[i] && pFreq[i] <= v) {
+                v = pFreq[i];
+                c1 = i;
+            }
+        }
+        v = 0xffffffff;
+        for (i=0; i<=256; i++) {
+            if (pFreq[i] && pFreq[i] <= v && i != c1) {
+                v = pFreq[i];
+                c2 = i;
+            }
+        }
+        if (c2 < 0) break;
+        pFreq[c1] += pFreq[c2];
+        pFreq[c2] = 0;
+        sCodeSize[c1]++;
+        while (sOthers[c1] >= 0) {
+            c1 = sOthers[c1];
+            sCodeSize[c1]++;
+        }
+        sOthers[c1] = (short)c2;
+        sCodeSize[c2]++;
+        while (sOthers[c2] >= 0) {
+            c2 = sOthers[c2];
+            sCodeSize[c2]++;
+        }
+    }
+    for (i=0; i<=256; i++) {
+        iBits[sCodeSize[i]]++;
+    }
+    for (i=257; i>16; i--) { // limit the codes to 16 bits (Annex K.3)
+        while (iBits[i] > 0) {
+            j = i - 2;
+            while (iBits[j] == 0) j--;
+            iBits[i] -= 2;
+            iBits[i-1]++;
+            iBits[j+1] += 2;
+            iBits[j]--;
+        }
+    }
+    for (i=16; iBits[i] == 0; i--) {};
+    iBits[i]--; // remove the reserved symbol
+    iCount = 0;
+    for (i=1; i<=256; i++) { // symbols in order of code length
+        for (j=0; j<256; j++) {
+            if (sCodeSize[j] == i) pVals[iCount++] = (uint8_t)j;
+        }
+    }
+    iCode = iCount = 0;
+    for (i=1; i<=16; i++) { // canonical codes (Annex C)
+        pBits[i-1] = (uint8_t)iBits[i];
+        for (j=0; j<iBits[i]; j++) {
+            pCode[pVals[iCount]] = (uint16_t)iCode++;
+            pCodeLen[pVals[iCount++]] = (uint8_t)i;
+        }
+        iCode <<= 1;
+    }
+    return iCount;
+} /* JPEGProgMakeTable() */
+//
+// Write the scans of a progressive JPEG from the stored coefficients
+//
+int JPEGEncodeProgressive(JPEGE_IMAGE *pJPEG)
+{
+    JPEGE_PROG_WORK *pWork = (JPEGE_PROG_WORK *)pJPEG->pProgWork;
+    const JPEGE_SCAN *pScan, *pScans = pJPEG->pScans;
+    int i, j, t, c, iScans = pJPEG->iScans, iLen, iOffset;
+    int iCount[2];
+    uint8_t *pBuf;
+
+    if (pScans == NULL) {
+        pScans = (pJPEG->ucNumComponents == 3) ? scanColor : scanGray;
+        iScans = (pJPEG->ucNumComponents == 3) ? 10 : 6;
+    }
+    for (i=0; i<iScans && pJPEG->iError == JPEGE_SUCCESS; i++) {
+        pScan = &pScans[i];
+        // first pass: count the symbols and make the tables
+        memset(pWork->ulFreq, 0, sizeof(pWork->ulFreq));
+        iCount[0] = iCount[1] = 0;
+        if (pScan->ucSs != 0 || pScan->ucAh == 0) { // DC refinement has no Huffman codes
+            pWork->bGather = 1;
+            JPEGProgScanPass(pJPEG, pWork, pScan);
+            for (t=0; t<2; t++) {
+                for (j=0; j<256 && pWork->ulFreq[t][j] == 0; j++) {};
+                if (j < 256) // this table is used
+                    iCount[t] = JPEGProgMakeTable(pWork->ulFreq[t], pWork->ucBits[t], pWork->ucVals[t], pWork->usCode[t], pWork->ucCodeLen[t]);
+            }
+        }
+        // DHT + SOS
+        if (JPEGProgCheckOutput(pJPEG, 600) != JPEGE_SUCCESS)
+            break;
+        pBuf = pJPEG->pc.pOut;
+        iOffset = 0;
+        if (iCount[0] + iCount[1]) {
+            iLen = 2;
+            for (t=0; t<2; t++) {
+                if (iCount[t]) iLen += 17 + iCount[t];
+            }
+            WRITEMOTO16(pBuf, iOffset, 0xffc4); // Huffman table(s)
+            iOffset += 2;
+            WRITEMOTO16(pBuf, iOffset, iLen);
+            iOffset += 2;
+            for (t=0; t<2; t++) {
+                if (iCount[t] == 0) continue;
+                pBuf[iOffset++] = (uint8_t)(((pScan->ucSs) ? 0x10 : 0) | t); // class (DC/AC) and id
+                memcpy(&pBuf[iOffset], pWork->ucBits[t], 16);
+                iOffset += 16;
+                memcpy(&pBuf[iOffset], pWork->ucVals[t], iCount[t]);
+                iOffset += iCount[t];
+            }
+        }
+        c = (pScan->ucComponent == JPEGE_SCAN_ALL_COMPONENTS) ? pJPEG->ucNumComponents : 1;
+        WRITEMOTO16(pBuf, iOffset, 0xffda); // SOS
+        iOffset += 2;
+        WRITEMOTO16(pBuf, iOffset, 6 + c*2);
+        iOffset += 2;
+        pBuf[iOffset++] = (uint8_t)c; // number of components in scan
+        for (j=0; j<c; j++) {
+            t = (c == 1 && pScan->ucComponent != JPEGE_SCAN_ALL_COMPONENTS) ? pScan->ucComponent : j;
+            pBuf[iOffset++] = (uint8_t)t; // component id
+            pBuf[iOffset++] = (pScan->ucSs == 0 && t != 0) ? 0x10 : 0; // DC/AC table
+        }
+        pBuf[iOffset++] = pScan->ucSs; // spectral selection
+        pBuf[iOffset++] = pScan->ucSe;
+        pBuf[iOffset++] = (uint8_t)((pScan->ucAh << 4) | pScan->ucAl); // successive approximation
+        pJPEG->pc.pOut += iOffset;
+        // second pass: write the scan
+        pWork->bGather = 0;
+        JPEGProgScanPass(pJPEG, pWork, pScan);
+        JPEGProgFlush(pJPEG);
+    } // for each scan
+    if (pJPEG->iError == JPEGE_SUCCESS && pJPEG->pOutput) {
+        pJPEG->iDataSize = (int)(pJPEG->pc.pOut - pJPEG->pOutput);
+    }
+    return pJPEG->iError;
+} /* JPEGEncodeProgressive() */
+//
+// Arithmetic coding (SOF9) of the same quantized blocks; this follows the
+// QM-coder of T.81 Annex D and the default conditioning (L=0, U=1, Kx=5)
+//
+void JPEGArithReset(JPEGE_IMAGE *pJPEG)
+{
+    JPEGE_ARITH *pA = pJPEG->pArith;
+
+    pA->c = 0;
+    pA->a = 0x10000;
+    pA->sc = pA->zc = 0;
+    pA->ct = 11;
+    pA->iBuffer = -1; // nothing held back yet
+    pA->iDCContext[0] = pA->iDCContext[1] = pA->iDCContext[2] = 0;
+    memset(pA->ucDCStats, 0, sizeof(pA->ucDCStats));
+    memset(pA->ucACStats, 0, sizeof(pA->ucACStats));
+    pA->ucFixedBin = 113;
+} /* JPEGArithReset() */
+//
+// Write the pending 0x00 bytes followed by one byte (with a stuffed 0 after 0xFF)
+//
+void JPEGArithByte(JPEGE_IMAGE *pJPEG, int iByte)
+{
+    JPEGE_ARITH *pA = pJPEG->pArith;
+
+    while (pA->zc) {
+        *pJPEG->pc.pOut++ = 0;
+        pA->zc--;
+    }
+    *pJPEG->pc.pOut++ = (uint8_t)iByte;
+    if (iByte == 0xff)
+        *pJPEG->pc.pOut++ = 0;
+} /* JPEGArithByte() */
+//
+// Move the top byte of the code register to the output; it is held back
+// in case a later carry propagates into it
+//
+void JPEGArithOutput(JPEGE_IMAGE *pJPEG, int iByte)
+{
+    JPEGE_ARITH *pA = pJPEG->pArith;
+
+    if (iByte > 0xff) { // carry into the held byte; stacked 0xFFs become 0x00s
+        if (pA->iBuffer >= 0)
+            JPEGArithByte(pJPEG, pA->iBuffer + 1);
+        pA->zc += pA->sc;
+        pA->sc = 0;
+        pA->iBuffer = iByte & 0xff;
+    } else if (iByte == 0xff) { // might still overflow
+        pA->sc++;
+    } else { // the held byte and stacked 0xFFs are final now
+        if (pA->iBuffer == 0)
+            pA->zc++; // zeros are deferred, the final ones are never written
+        else if (pA->iBuffer > 0)
+            JPEGArithByte(pJPEG, pA->iBuffer);
+        for (; pA->sc; pA->sc--)
+            JPEGArithByte(pJPEG, 0xff);
+        pA->iBuffer = iByte;
+    }
+} /* JPEGArithOutput() */
+//
+// Code one binary decision with the adaptive estimate in *pStat
+//
+void JPEGArithEncode(JPEGE_IMAGE *pJPEG, uint8_t *pStat, int iVal)
+{
+    JPEGE_ARITH *pA = pJPEG->pArith;
+    int32_t qe;
+    int sv = *pStat;
+    uint8_t ucNextLPS, ucNextMPS;
+
+    qe = (int32_t)ulArithQe[sv & 0x7f];
+    ucNextLPS = (uint8_t)qe; // with the MPS switch in bit 7
+    ucNextMPS = (uint8_t)(qe >> 8);
+    qe >>= 16;
+    pA->a -= qe;
+    if (iVal != (sv >> 7)) { // less probable symbol
+        if (pA->a >= qe) {
+            pA->c += pA->a;
+            pA->a = qe;
+        }
+        *pStat = (uint8_t)((sv & 0x80) ^ ucNextLPS);
+    } else { // more probable symbol
+        if (pA->a >= 0x8000)
+            return; // no renormalization needed
+        if (pA->a < qe) {
+            pA->c += pA->a;
+            pA->a = qe;
+        }
+        *pStat = (uint8_t)((sv & 0x80) ^ ucNextMPS);
+    }
+    do { // renormalize
+        pA->a <<= 1;
+        pA->c <<= 1;
+        if (--pA->ct == 0) {
+            JPEGArithOutput(pJPEG, (int)(pA->c >> 19));
+            pA->c &= 0x7ffff;
+            pA->ct += 8;
+        }
+    } while (pA->a < 0x8000);
+} /* JPEGArithEncode() */
+//
+// Terminate the arithmetic coded segment (T.81 D.1.8)
+//
+void JPEGArithFlush(JPEGE_IMAGE *pJPEG)
+{
+    JPEGE_ARITH *pA = pJPEG->pArith;
+    int32_t temp;
+
+    // pick the value in the final interval with the most trailing zeros
+    temp = (pA->a - 1 + pA->c) & 0xffff0000;
+    pA->c = (temp < pA->c) ? temp + 0x8000 : temp;
+    pA->c <<= pA->ct;
+    JPEGArithOutput(pJPEG, (pA->c & 0xf8000000) ? 0x100 : 0); // resolve the held byte
+    // the trailing 0 bytes are implied, write the rest
+    if (pA->c & 0x7fff800) {
+        JPEGArithByte(pJPEG, (pA->c >> 19) & 0xff);
+        if (pA->c & 0x7f800)
+            JPEGArithByte(pJPEG, (pA->c >> 11) & 0xff);
+    }
+} /* JPEGArithFlush() */
+//
+// Arithmetic code one quantized block (T.81 F.1.4)
+// Returns the new DC predictor value like JPEGEncodeMCU()
+//
+int JPEGArithEncodeMCU(int iComponent, JPEGE_IMAGE *pJPEG, signed short *pMCUData, int iDCPred, int bSparse)
+{
+    JPEGE_ARITH *pA = pJPEG->pArith;
+    int iTable = (iComponent) ? 1 : 0;
+    int k, ke, m, v, v2;
+    uint8_t *st;
+
+    // DC difference, conditioned on the previous difference of this component
+    st = &pA->ucDCStats[iTable][pA->iDCContext[iComponent]];
+    v = pMCUData[0] - iDCPred;
+    if (v == 0) {
+        JPEGArithEncode(pJPEG, st, 0);
+        pA->iDCContext[iComponent] = 0;
+    } else {
+        JPEGArithEncode(pJPEG, st, 1);
+        if (v > 0) {
+            JPEGArithEncode(pJPEG, st + 1, 0);
+            st += 2;
+            pA->iDCContext[iComponent] = 4;
+        } else {
+            v = -v;
+            JPEGArithEncode(pJPEG, st + 1, 1);
+            st += 3;
+            pA->iDCContext[iComponent] = 8;
+        }
+        m = 0;
+        if (--v) { // magnitude category
+            JPEGArithEncode(pJPEG, st, 1);
+            m = 1;
+            v2 = v;
+            st = &pA->ucDCStats[iTable][20];
+            while (v2 >>= 1) {
+                JPEGArithEncode(pJPEG, st, 1);
+                m <<= 1;
+                st++;
+            }
+        }
+        JPEGArithEncode(pJPEG, st, 0);
+        if (m > 1) // large difference (U = 1)
+            pA->iDCContext[iComponent] += 8;
+        st += 14;
+        while (m >>= 1) // magnitude bits
+            JPEGArithEncode(pJPEG, st, (m & v) ? 1 : 0);
+    }
+    // AC coefficients up to the last non-zero one
+    for (ke = (bSparse) ? 32 : 63; ke > 0 && pMCUData[cZigZag2[ke]] == 0; ke--) {};
+    for (k = 0; k < ke;) {
+        st = &pA->ucACStats[iTable][3 * k];
+        JPEGArithEncode(pJPEG, st, 0); // not the end of the block
+        while ((v = pMCUData[cZigZag2[++k]]) == 0) {
+            JPEGArithEncode(pJPEG, st + 1, 0);
+            st += 3;
+        }
+        JPEGArithEncode(pJPEG, st + 1, 1);
+        if (v > 0) {
+            JPEGArithEncode(pJPEG, &pA->ucFixedBin, 0);
+        } else {
+            v = -v;
+            JPEGArithEncode(pJPEG, &pA->ucFixedBin, 1);
+        }
+        st += 2;
+        m = 0;
+        if (--v) { // magnitude category
+            JPEGArithEncode(pJPEG, st, 1);
+            m = 1;
+            v2 = v;
+            if (v2 >>= 1) {
+                JPEGArithEncode(pJPEG, st, 1);
+                m <<= 1;
+                st = &pA->ucACStats[iTable][(k <= 5) ? 189 : 217]; // Kx = 5
+                while (v2 >>= 1) {
+                    JPEGArithEncode(pJPEG, st, 1);
+                    m <<= 1;
+                    st++;
+                }
+            }
+        }
+        JPEGArithEncode(pJPEG, st, 0);
+        st += 14;
+        while (m >>= 1) // magnitude bits
+            JPEGArithEncode(pJPEG, st, (m & v) ? 1 : 0);
+    }
+    if (k < 63) // end of block
+        JPEGArithEncode(pJPEG, &pA->ucACStats[iTable][3 * k], 1);
+    return pMCUData[0];
+} /* JPEGArithEncodeMCU() */
+//
 // Finish the file
 //
 int JPEGEncodeEnd(JPEGE_IMAGE *pJPEG)
 {
     if (pJPEG->iError == JPEGE_SUCCESS)
     {
+        if (pJPEG->pProgArena && JPEGEncodeProgressive(pJPEG) != JPEGE_SUCCESS) {
+            pJPEG->iDataSize = 0; // the scans didn't fit
+            return 0;
+        }
         if (pJPEG->pOutput == NULL) { // file I/O
             int iLen;
             *pJPEG->pc.pOut++ = 0xff; // end of image (EOI)
             *pJPEG->pc.pOut++ = 0xd9;
-            iLen = (int)(pJPEG->pc.pOut - pJPEG->ucFileBuf);
-            pJPEG->pfnWrite(&pJPEG->JPEGFile, pJPEG->ucFileBuf, iLen);
+            iLen = (int)(pJPEG->pc.pOut - pJPEG->pFileBuf);
+            pJPEG->pfnWrite(&pJPEG->JPEGFile, pJPEG->pFileBuf, iLen);
             pJPEG->iDataSize += iLen;
         } else { // user-supplied buffer
             uint8_t *pBuf = pJPEG->pOutput; // DEBUG - check for non-buffer option
@@ -821,92 +1563,474 @@ int JPEGEncodeEnd(JPEGE_IMAGE *pJPEG)
     return 0; // something went wrong
 } /* JPEGEncodeEnd() */
 //
-// Initialize the encoder
+// Request a JFIF thumbnail of at most iMaxSize x iMaxSize pixels (0 = none)
+// The current row is kept in the caller's pWork (JPEGE_THUMB_WORK_SIZE bytes)
+// Call after opening the output and before JPEGEncodeBegin()
 //
-int JPEGEncodeBegin(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, int iWidth, int iHeight, uint8_t ucPixelType, uint8_t ucSubSample, uint8_t ucQFactor)
+int JPEGSetThumbnail(JPEGE_IMAGE *pJPEG, int iMaxSize, uint8_t *pWork, int iWorkSize)
 {
-    uint8_t *pBuf;
-    int i;
-    int iOffset = 0;
-    if (pEncode == NULL || pJPEG == NULL) {
+    if (iMaxSize < 0 || iMaxSize > JPEGE_THUMB_MAX_SIZE || (iMaxSize && (pWork == NULL || iWorkSize < JPEGE_THUMB_WORK_SIZE(iMaxSize)))) {
+        pJPEG->iError = JPEGE_INVALID_PARAMETER;
         return JPEGE_INVALID_PARAMETER;
     }
-    if (iWidth < 1 || iHeight < 1) {
+    pJPEG->ucThumbMax = (uint8_t)iMaxSize;
+    pJPEG->pThumbAcc = (uint16_t *)(((intptr_t)pWork + 1) & ~(intptr_t)1);
+    return JPEGE_SUCCESS;
+} /* JPEGSetThumbnail() */
+//
+// Set the number of significant bits (8-16) of 16-bit samples
+// Call after opening the output and before JPEGEncodeBegin()
+//
+int JPEGSetSampleBits(JPEGE_IMAGE *pJPEG, int iBits)
+{
+    if (iBits < 8 || iBits > 16) {
+        pJPEG->iError = JPEGE_INVALID_PARAMETER;
         return JPEGE_INVALID_PARAMETER;
     }
-    if (ucPixelType >= JPEGE_PIXEL_COUNT || (ucSubSample != JPEGE_SUBSAMPLE_444 && ucSubSample != JPEGE_SUBSAMPLE_420) || ucQFactor > JPEGE_Q_LOW) {
+    pJPEG->ucSampleBits = (uint8_t)iBits;
+    return JPEGE_SUCCESS;
+} /* JPEGSetSampleBits() */
+//
+// Use a table to convert 16-bit samples to 8 bits (NULL = shift them)
+// Call after opening the output and before JPEGEncodeBegin()
+//
+int JPEGSetToneMap(JPEGE_IMAGE *pJPEG, const uint8_t *pLUT)
+{
+    pJPEG->pToneMap = pLUT;
+    return JPEGE_SUCCESS;
+} /* JPEGSetToneMap() */
+//
+// Encode the alpha channel of a 32-bpp source with a second encoder
+// Both must be opened; call before JPEGEncodeBegin(), which starts both
+//
+int JPEGSetAlphaEncoder(JPEGE_IMAGE *pJPEG, JPEGE_IMAGE *pAlpha, JPEGENCODE *pAlphaEncode)
+{
+    if (pAlpha == NULL || pAlphaEncode == NULL || pAlpha == pJPEG) {
+        pJPEG->iError = JPEGE_INVALID_PARAMETER;
         return JPEGE_INVALID_PARAMETER;
     }
-    pJPEG->iDCPred0 = pJPEG->iDCPred1 = pJPEG->iDCPred2 = 0; // DC predictor values reset to 0
-    pJPEG->iWidth = iWidth;
-    pJPEG->iHeight = iHeight;
-    pJPEG->ucPixelType = ucPixelType;
-    pJPEG->ucSubSample = ucSubSample;
-    pEncode->x = pEncode->y = 0; // starting point
-    if (ucSubSample == JPEGE_SUBSAMPLE_444) {
-        pEncode->cx = pEncode->cy = 8;
-    } else {
-        pEncode->cx = pEncode->cy = 16; // MCU size
+    pJPEG->pAlpha = pAlpha;
+    pJPEG->pAlphaEncode = pAlphaEncode;
+    pAlpha->ucAlphaPlane = 1;
+    return JPEGE_SUCCESS;
+} /* JPEGSetAlphaEncoder() */
+//
+// Write a progressive (SOF2) file; the quantized coefficients are kept in
+// the caller's arena and the scans are written by JPEGEncodeEnd()
+// pScans = NULL uses a default script similar to libjpeg's
+// Call before JPEGEncodeBegin()
+//
+int JPEGSetProgressive(JPEGE_IMAGE *pJPEG, uint8_t *pArena, int iArenaSize, const JPEGE_SCAN *pScans, int iScans)
+{
+    if (pArena == NULL || iArenaSize <= 0 || (pScans != NULL && iScans < 1)) {
+        pJPEG->iError = JPEGE_INVALID_PARAMETER;
+        return JPEGE_INVALID_PARAMETER;
     }
-    // Number of MCUs in each dimension
-    pJPEG->iMCUWidth = (pJPEG->iWidth + pEncode->cx - 1) / pEncode->cx;
-    pJPEG->iMCUHeight = (pJPEG->iHeight + pEncode->cy - 1) / pEncode->cy;
-    
-    // Set up the output buffer
-    pJPEG->pc.iLen = pJPEG->pc.ulAcc = 0;
-    if (pJPEG->pOutput) {
-        pBuf = pJPEG->pOutput;
+    pJPEG->pProgArena = pArena;
+    pJPEG->iProgArenaSize = iArenaSize;
+    pJPEG->pScans = pScans;
+    pJPEG->iScans = iScans;
+    return JPEGE_SUCCESS;
+} /* JPEGSetProgressive() */
+//
+// Return the arena size needed by JPEGSetProgressive() for an image
+// with the same parameters as JPEGEncodeBegin() (0 = invalid)
+//
+int JPEGGetProgressiveSize(int iWidth, int iHeight, uint8_t ucPixelType, uint8_t ucSubSample, uint8_t ucOrientation, uint8_t ucScale)
+{
+    int i, cx, cy, iBlocks;
+
+    if (iWidth < 1 || iHeight < 1 || ucPixelType >= JPEGE_PIXEL_COUNT || ucSubSample > JPEGE_SUBSAMPLE_400 || ucOrientation >= JPEGE_ORIENT_COUNT || ucScale >= JPEGE_SCALE_COUNT) {
+        return 0;
+    }
+    iWidth = (iWidth + (1 << ucScale) - 1) >> ucScale;
+    iHeight = (iHeight + (1 << ucScale) - 1) >> ucScale;
+    if (cOrientXForm[ucOrientation][1] != 0) {
+        i = iWidth; iWidth = iHeight; iHeight = i;
+    }
+    if (ucPixelType == JPEGE_PIXEL_GRAYSCALE || ucPixelType == JPEGE_PIXEL_GRAY16 || ucSubSample == JPEGE_SUBSAMPLE_400) {
+        cx = cy = 8;
+        iBlocks = 1;
+    } else if (ucSubSample == JPEGE_SUBSAMPLE_444) {
+        cx = cy = 8;
+        iBlocks = 3;
+    } else if (ucSubSample == JPEGE_SUBSAMPLE_422) {
+        cx = 16; cy = 8;
+        iBlocks = 4;
     } else {
-        pBuf = pJPEG->ucFileBuf;
+        cx = cy = 16;
+        iBlocks = 6;
     }
-    // Write the JPEG header
-    if (pJPEG->ucPixelType == JPEGE_PIXEL_GRAYSCALE)
-        pJPEG->ucNumComponents = 1;
-    else
-        pJPEG->ucNumComponents = 3;
-    WRITEMOTO32(pBuf, iOffset, 0xffd8ffe0); // write app0 marker
-    iOffset += 4;
-    WRITEMOTO32(pBuf, iOffset, 0x00104a46); // JFIF
-    iOffset += 4;
-    WRITEMOTO32(pBuf, iOffset, 0x49460001);
-    iOffset += 4;
-    WRITEMOTO16(pBuf, iOffset, 0x0101); // resolution units = dots per inch
-    iOffset += 2;
-    WRITEMOTO16(pBuf, iOffset, 0); // DEBUG - store spacial resolution as 0 for now
-    iOffset += 2;
-    WRITEMOTO16(pBuf, iOffset, 0);
-    iOffset += 2;
-    WRITEMOTO16(pBuf, iOffset, 0); // add 2 zeros
-    iOffset += 2;
-    // define quantization tables
-    WRITEMOTO16(pBuf, iOffset, 0xffdb); // quantization table marker
-    iOffset += 2;
-    WRITEMOTO16(pBuf, iOffset, 0x0043); // table size
-    iOffset += 2;
-    pBuf[iOffset++] = 0; // table type and number 0,8 bit
-    for (i=0; i<64; i++)
-    {
-        switch (ucQFactor) // adjust table depending on quality factor
-        {
-            default:
-            case JPEGE_Q_BEST: // best quality, divide by 4
-                pBuf[iOffset++] = quant_lum[i] >> 2;
-                break;
-            case JPEGE_Q_HIGH: // high quality, divide by 2
-                pBuf[iOffset++] = quant_lum[i] >> 1;
-                break;
-            case JPEGE_Q_MED: // medium quality factor, use values unchanged
-                pBuf[iOffset++] = quant_lum[i];
-                break;
-            case JPEGE_Q_LOW: // low quality, use values * 2
-                pBuf[iOffset++] = quant_lum[i] << 1;
-                break;
-//            case 4: // ridiculously high quality
-//                pBuf[iOffset++] = quant95_lum[i];
-//                break;
-        }
+    iBlocks *= ((iWidth + cx - 1) / cx) * ((iHeight + cy - 1) / cy);
+    return (int)sizeof(JPEGE_PROG_WORK) + 3 + iBlocks * DCTSIZE * (int)sizeof(signed short);
+} /* JPEGGetProgressiveSize() */
+//
+// Upper bound of the size of a baseline (Huffman) JPEG with these options
+// Each coefficient is given the longest code its quantized range allows in
+// the tables for this quality, every byte is assumed to need stuffing and
+// every MCU a restart marker. iThumbMax is the JPEGSetThumbnail() size (0 =
+// none). It includes the 512 bytes the encoder keeps free at the end of the
+// output buffer, so a buffer of exactly this size can't run out of space.
+//
+int JPEGMaxEncodedSize(int iWidth, int iHeight, uint8_t ucPixelType, uint8_t ucSubSample, uint8_t ucQFactor, uint8_t ucOrientation, uint8_t ucScale, int iThumbMax)
+{
+    const unsigned char *pQuant;
+    unsigned short *pHuff;
+    int i, t, q, r, iSize, iMag, iMax, cx, cy, iLuma, iChroma, iMCUs, iBits[2];
+    int64_t llSize;
+
+    if (iWidth < 1 || iHeight < 1 || ucPixelType >= JPEGE_PIXEL_COUNT || ucSubSample > JPEGE_SUBSAMPLE_400 || ucQFactor > JPEGE_Q_LOW || ucOrientation >= JPEGE_ORIENT_COUNT || ucScale >= JPEGE_SCALE_COUNT || iThumbMax < 0 || iThumbMax > JPEGE_THUMB_MAX_SIZE) {
+        return 0;
     }
-    if (pJPEG->ucPixelType != JPEGE_PIXEL_GRAYSCALE) // add color quant tables
+    iWidth = (iWidth + (1 << ucScale) - 1) >> ucScale;
+    iHeight = (iHeight + (1 << ucScale) - 1) >> ucScale;
+    if (cOrientXForm[ucOrientation][1] != 0) {
+        i = iWidth; iWidth = iHeight; iHeight = i;
+    }
+    if (ucPixelType == JPEGE_PIXEL_GRAYSCALE || ucPixelType == JPEGE_PIXEL_GRAY16 || ucSubSample == JPEGE_SUBSAMPLE_400) {
+        cx = cy = 8;
+        iLuma = 1; iChroma = 0;
+    } else if (ucSubSample == JPEGE_SUBSAMPLE_444) {
+        cx = cy = 8;
+        iLuma = 1; iChroma = 2;
+    } else if (ucSubSample == JPEGE_SUBSAMPLE_422) {
+        cx = 16; cy = 8;
+        iLuma = 2; iChroma = 2;
+    } else {
+        cx = cy = 16;
+        iLuma = 4; iChroma = 2;
+    }
+    iMCUs = ((iWidth + cx - 1) / cx) * ((iHeight + cy - 1) / cy);
+    for (t=0; t<2; t++) { // most bits a luma/chroma block can take
+        pQuant = (t) ? quant_color : quant_lum;
+        pHuff = (unsigned short *)&hufftable[t * 2048];
+        iBits[t] = pHuff[768]; // EOB
+        for (i=0; i<DCTSIZE; i++) {
+            q = (ucQFactor < JPEGE_Q_MED) ? (pQuant[i] >> (JPEGE_Q_MED - ucQFactor)) : (pQuant[i] << (ucQFactor - JPEGE_Q_MED)); // as in JPEGEncodeBegin()
+            iMag = (1040 + (q >> 1)) / q; // DCT coefficients of 8-bit samples stay within +/-1024; allow for rounding
+            if (i == 0) iMag *= 2; // DC difference
+            for (iSize = 0; (iMag >> iSize); iSize++) {};
+            iMax = 0;
+            if (i == 0) {
+                for (q = 0; q <= iSize && q <= 11; q++) {
+                    if (pHuff[256 + q] + q > iMax) iMax = pHuff[256 + q] + q;
+                }
+            } else {
+                for (r = 0; r < 16; r++) { // any run of zeros before it
+                    for (q = 1; q <= iSize && q <= 10; q++) {
+                        if (pHuff[768 + (r << 4) + q] + q > iMax) iMax = pHuff[768 + (r << 4) + q] + q;
+                    }
+                }
+            }
+            iBits[t] += iMax;
+        }
+    }
+    llSize = (int64_t)(iLuma * iBits[0] + iChroma * iBits[1]) * iMCUs;
+    llSize = ((llSize + 7) >> 3) * 2; // 0 stuffed after each byte
+    llSize += (int64_t)iMCUs * 4 + 1024 + 512; // RSTn and padding, headers and EOI, high water margin
+    i = iThumbMax * iThumbMax * 3;
+    llSize += (i > 0xffff - 16) ? 0xffff - 16 : i; // it has to fit in APP0
+    return (llSize > 0x7fffffff) ? 0x7fffffff : (int)llSize;
+} /* JPEGMaxEncodedSize() */
+//
+// Select arithmetic coding (SOF9) instead of Huffman coding; its state is
+// kept in the caller's pWork (NULL = Huffman)
+// Call before JPEGEncodeBegin()
+//
+int JPEGSetArithmetic(JPEGE_IMAGE *pJPEG, uint8_t *pWork, int iWorkSize)
+{
+    if (pWork != NULL && iWorkSize < JPEGE_ARITH_WORK_SIZE) {
+        pJPEG->iError = JPEGE_INVALID_PARAMETER;
+        return JPEGE_INVALID_PARAMETER;
+    }
+    pJPEG->pArith = (JPEGE_ARITH *)(((intptr_t)pWork + 3) & ~(intptr_t)3);
+    pJPEG->ucArithmetic = (uint8_t)(pWork != NULL);
+    return JPEGE_SUCCESS;
+} /* JPEGSetArithmetic() */
+//
+// Enable rate-distortion optimized quantization (0 = off)
+// iLambda is the squared error (in 8-bit pixel units) that one bit is worth
+// Call before JPEGEncodeBegin()
+//
+int JPEGSetTrellis(JPEGE_IMAGE *pJPEG, int iLambda)
+{
+    if (iLambda < 0 || iLambda > 0xffff) {
+        pJPEG->iError = JPEGE_INVALID_PARAMETER;
+        return JPEGE_INVALID_PARAMETER;
+    }
+    pJPEG->usLambda = (uint16_t)iLambda;
+    return JPEGE_SUCCESS;
+} /* JPEGSetTrellis() */
+//
+// Set the dead zone and isolated coefficient suppression for the
+// luma (0) or chroma (1) quantizer
+// Call before JPEGEncodeBegin()
+//
+int JPEGSetDeadZone(JPEGE_IMAGE *pJPEG, int iComponent, int iDeadZone, int iIsolated)
+{
+    if (iComponent < 0 || iComponent > 1 || iDeadZone < 0 || iDeadZone > 8 || iIsolated < 0 || iIsolated > 63) {
+        pJPEG->iError = JPEGE_INVALID_PARAMETER;
+        return JPEGE_INVALID_PARAMETER;
+    }
+    pJPEG->ucDeadZone[iComponent] = (uint8_t)iDeadZone;
+    pJPEG->ucIsolated[iComponent] = (uint8_t)iIsolated;
+    return JPEGE_SUCCESS;
+} /* JPEGSetDeadZone() */
+//
+// Set the per-MCU importance map (NULL = off)
+// The pitch is checked against the MCU count in JPEGEncodeBegin()
+//
+int JPEGSetROI(JPEGE_IMAGE *pJPEG, const uint8_t *pMap, int iPitch)
+{
+    if (pMap && iPitch < 1) {
+        pJPEG->iError = JPEGE_INVALID_PARAMETER;
+        return JPEGE_INVALID_PARAMETER;
+    }
+    pJPEG->pROIMap = pMap;
+    pJPEG->iROIPitch = iPitch;
+    return JPEGE_SUCCESS;
+} /* JPEGSetROI() */
+//
+// Set the restart interval in MCUs or MCU rows (0 = no restart markers)
+// The total is checked against the 16-bit DRI field in JPEGEncodeBegin()
+//
+int JPEGSetRestartInterval(JPEGE_IMAGE *pJPEG, int iInterval, int iUnit)
+{
+    if (iInterval < 0 || iInterval > 0xffff || (iUnit != JPEGE_RESTART_MCUS && iUnit != JPEGE_RESTART_ROWS)) {
+        pJPEG->iError = JPEGE_INVALID_PARAMETER;
+        return JPEGE_INVALID_PARAMETER;
+    }
+    pJPEG->usRestartCount = (uint16_t)iInterval;
+    pJPEG->ucRestartUnit = (uint8_t)iUnit;
+    return JPEGE_SUCCESS;
+} /* JPEGSetRestartInterval() */
+//
+// Let the memory output grow through a callback (NULL = fixed size)
+// Call after opening the output and before JPEGEncodeBegin()
+//
+int JPEGSetGrowCallback(JPEGE_IMAGE *pJPEG, JPEGE_GROW_CALLBACK *pfnGrow)
+{
+    if (pJPEG->pOutput == NULL && pfnGrow) { // file output doesn't need it
+        pJPEG->iError = JPEGE_INVALID_PARAMETER;
+        return JPEGE_INVALID_PARAMETER;
+    }
+    pJPEG->pfnGrow = pfnGrow;
+    return JPEGE_SUCCESS;
+} /* JPEGSetGrowCallback() */
+//
+// Convert a 16-bit sample to 8 bits with the tone map or a shift
+//
+int JPEGToneMap(JPEGE_IMAGE *pJPEG, int iSample)
+{
+    int iBits = pJPEG->ucSampleBits ? pJPEG->ucSampleBits : 16;
+
+    if (iSample >= (1 << iBits)) iSample = (1 << iBits) - 1; // stray high bits
+    if (pJPEG->pToneMap)
+        return pJPEG->pToneMap[iSample];
+    return iSample >> (iBits - 8);
+} /* JPEGToneMap() */
+//
+// Initialize the encoder
+//
+int JPEGEncodeBegin(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, int iWidth, int iHeight, uint8_t ucPixelType, uint8_t ucSubSample, uint8_t ucQFactor, uint8_t ucOrientation, uint8_t ucScale)
+{
+    uint8_t *pBuf;
+    int i, iThumbBytes, iBlocksW, iBlocksH;
+    int iOffset = 0;
+    if (pEncode == NULL || pJPEG == NULL) {
+        return JPEGE_INVALID_PARAMETER;
+    }
+    if (iWidth < 1 || iHeight < 1) {
+        return JPEGE_INVALID_PARAMETER;
+    }
+    if (ucPixelType >= JPEGE_PIXEL_COUNT || ucSubSample > JPEGE_SUBSAMPLE_400 || ucQFactor > JPEGE_Q_LOW || ucOrientation >= JPEGE_ORIENT_COUNT || ucScale >= JPEGE_SCALE_COUNT) {
+        return JPEGE_INVALID_PARAMETER;
+    }
+    if (ucPixelType >= JPEGE_PIXEL_I420 && (ucOrientation != JPEGE_ORIENT_NONE || ucScale != JPEGE_SCALE_NONE)) {
+        return JPEGE_UNSUPPORTED_FEATURE; // planar and Bayer sources are only read in place
+    }
+    if ((pJPEG->ucAlphaPlane || pJPEG->pAlpha) && ucPixelType != JPEGE_PIXEL_ARGB8888 && ucPixelType != JPEGE_PIXEL_BGRA8888) {
+        return JPEGE_UNSUPPORTED_FEATURE; // no alpha channel
+    }
+    if (pJPEG->ucArithmetic && pJPEG->pProgArena) {
+        return JPEGE_UNSUPPORTED_FEATURE; // no SOF10
+    }
+    if (pJPEG->pAlpha) { // start the alpha encoder with the same geometry
+        i = JPEGEncodeBegin(pJPEG->pAlpha, pJPEG->pAlphaEncode, iWidth, iHeight, ucPixelType, JPEGE_SUBSAMPLE_444, ucQFactor, ucOrientation, ucScale);
+        if (i != JPEGE_SUCCESS) {
+            pJPEG->iError = i;
+            return i;
+        }
+    }
+    pJPEG->iDCPred0 = pJPEG->iDCPred1 = pJPEG->iDCPred2 = 0; // DC predictor values reset to 0
+    pJPEG->iSrcWidth = iWidth;
+    pJPEG->iSrcHeight = iHeight;
+    pJPEG->ucOrientation = ucOrientation;
+    pJPEG->ucScale = ucScale;
+    iWidth = (iWidth + (1 << ucScale) - 1) >> ucScale; // partial blocks count as a whole pixel
+    iHeight = (iHeight + (1 << ucScale) - 1) >> ucScale;
+    if (cOrientXForm[ucOrientation][1] != 0) { // x comes from y, so the output size is swapped
+        pJPEG->iWidth = iHeight;
+        pJPEG->iHeight = iWidth;
+    } else {
+        pJPEG->iWidth = iWidth;
+        pJPEG->iHeight = iHeight;
+    }
+    pJPEG->ucPixelType = ucPixelType;
+    pJPEG->ucSubSample = ucSubSample;
+    pEncode->x = pEncode->y = 0; // starting point
+    if (ucPixelType == JPEGE_PIXEL_GRAYSCALE || ucPixelType == JPEGE_PIXEL_GRAY16 || pJPEG->ucAlphaPlane || ucSubSample == JPEGE_SUBSAMPLE_400)
+        pJPEG->ucNumComponents = 1;
+    else
+        pJPEG->ucNumComponents = 3;
+    if (ucSubSample == JPEGE_SUBSAMPLE_444 || pJPEG->ucNumComponents == 1) {
+        pEncode->cx = pEncode->cy = 8;
+    } else if (ucSubSample == JPEGE_SUBSAMPLE_422) {
+        pEncode->cx = 16; // MCU size
+        pEncode->cy = 8;
+    } else {
+        pEncode->cx = pEncode->cy = 16; // MCU size
+    }
+    // Number of MCUs in each dimension
+    pJPEG->iMCUWidth = (pJPEG->iWidth + pEncode->cx - 1) / pEncode->cx;
+    pJPEG->iMCUHeight = (pJPEG->iHeight + pEncode->cy - 1) / pEncode->cy;
+    if (pJPEG->pROIMap && pJPEG->iROIPitch < pJPEG->iMCUWidth) {
+        pJPEG->iError = JPEGE_INVALID_PARAMETER;
+        return JPEGE_INVALID_PARAMETER;
+    }
+    pJPEG->ucROIKeep = DCTSIZE; // every MCU is full quality without a map
+    if (pJPEG->ucRestartUnit == JPEGE_RESTART_MCUS)
+        pJPEG->iRestartMCUs = pJPEG->usRestartCount;
+    else if (pJPEG->ucRestartUnit == JPEGE_RESTART_ROWS)
+        pJPEG->iRestartMCUs = pJPEG->usRestartCount * pJPEG->iMCUWidth;
+    else
+        pJPEG->iRestartMCUs = pJPEG->iMCUWidth; // default of one MCU row
+    if (pJPEG->pProgArena) // progressive scans don't use restarts
+        pJPEG->iRestartMCUs = 0;
+    if (pJPEG->iRestartMCUs > 0xffff) {
+        pJPEG->iError = JPEGE_INVALID_PARAMETER;
+        return JPEGE_INVALID_PARAMETER;
+    }
+    pJPEG->iRestartLeft = pJPEG->iRestartMCUs;
+    pJPEG->iRestart = 0;
+    pJPEG->ucROIDeadZone = 0;
+    if (pJPEG->pProgArena) { // progressive; the coefficients are kept until the end
+        for (i=0; pJPEG->pScans && i<pJPEG->iScans; i++) {
+            const JPEGE_SCAN *pScan = &pJPEG->pScans[i];
+            if (pScan->ucSs > pScan->ucSe || pScan->ucSe > 63 || (pScan->ucSs == 0 && pScan->ucSe != 0) ||
+                pScan->ucAl > 13 || (pScan->ucAh != 0 && pScan->ucAh != pScan->ucAl + 1) ||
+                (pScan->ucComponent == JPEGE_SCAN_ALL_COMPONENTS ? pScan->ucSs != 0 : pScan->ucComponent >= pJPEG->ucNumComponents)) {
+                pJPEG->iError = JPEGE_INVALID_PARAMETER;
+                return JPEGE_INVALID_PARAMETER;
+            }
+        }
+        i = JPEGProgH(pJPEG, 0) * JPEGProgV(pJPEG, 0) * pJPEG->iMCUWidth * pJPEG->iMCUHeight * DCTSIZE; // Y coefficients
+        pBuf = (uint8_t *)(((intptr_t)pJPEG->pProgArena + 3) & ~(intptr_t)3);
+        pJPEG->pProgWork = pBuf;
+        pJPEG->pProgCoeffs[0] = (signed short *)&pBuf[sizeof(JPEGE_PROG_WORK)];
+        pJPEG->pProgCoeffs[1] = &pJPEG->pProgCoeffs[0][i];
+        pJPEG->pProgCoeffs[2] = &pJPEG->pProgCoeffs[1][pJPEG->iMCUWidth * pJPEG->iMCUHeight * DCTSIZE];
+        if (pJPEG->ucNumComponents == 3)
+            i = (int)(&pJPEG->pProgCoeffs[2][pJPEG->iMCUWidth * pJPEG->iMCUHeight * DCTSIZE] - pJPEG->pProgCoeffs[0]);
+        if ((uint8_t *)&pJPEG->pProgCoeffs[0][i] > pJPEG->pProgArena + pJPEG->iProgArenaSize) {
+            pJPEG->iError = JPEGE_NO_BUFFER; // see JPEGGetProgressiveSize()
+            return JPEGE_NO_BUFFER;
+        }
+    }
+    
+    // Set up the output buffer
+    pJPEG->pc.iLen = pJPEG->pc.ulAcc = 0;
+    if (pJPEG->ucArithmetic)
+        JPEGArithReset(pJPEG);
+    if (pJPEG->pOutput) {
+        pBuf = pJPEG->pOutput;
+    } else {
+        pBuf = pJPEG->pFileBuf;
+    }
+    // Write the JPEG header
+    iThumbBytes = 0;
+    pJPEG->ucThumbWidth = pJPEG->ucThumbHeight = 0;
+    if (pJPEG->ucThumbMax) { // thumbnail pixels are averages of 8x8 blocks (16x16 for 4:2:0)
+        iBlocksW = (pJPEG->iWidth + 7) >> 3;
+        iBlocksH = (pJPEG->iHeight + 7) >> 3;
+        i = (pEncode->cx == 16) ? 1 : 0; // match the chroma resolution
+        while (((iBlocksW + (1 << i) - 1) >> i) > pJPEG->ucThumbMax || ((iBlocksH + (1 << i) - 1) >> i) > pJPEG->ucThumbMax ||
+               ((iBlocksW + (1 << i) - 1) >> i) * ((iBlocksH + (1 << i) - 1) >> i) * 3 > 0xffff - 16) { // must fit in APP0
+            i++;
+        }
+        if (i <= 4) { // up to 16x16 blocks per pixel keeps the 16-bit sums from overflowing
+            pJPEG->ucThumbShift = (uint8_t)i;
+            pJPEG->ucThumbWidth = (uint8_t)((iBlocksW + (1 << i) - 1) >> i);
+            pJPEG->ucThumbHeight = (uint8_t)((iBlocksH + (1 << i) - 1) >> i);
+            iThumbBytes = pJPEG->ucThumbWidth * pJPEG->ucThumbHeight * 3;
+            memset(pJPEG->pThumbAcc, 0, pJPEG->ucThumbWidth * 3 * sizeof(uint16_t));
+        }
+        if (pJPEG->pOutput && JPEGE_THUMB_OFFSET + iThumbBytes + 1024 > pJPEG->iBufferSize) {
+            pJPEG->pc.pOut = pJPEG->pOutput; // nothing is written yet
+            if (JPEGGrowOutput(pJPEG, JPEGE_THUMB_OFFSET + iThumbBytes + 512) != JPEGE_SUCCESS)
+                return JPEGE_NO_BUFFER;
+            pBuf = pJPEG->pOutput;
+        }
+    }
+    WRITEMOTO32(pBuf, iOffset, 0xffd8ffe0); // write app0 marker
+    iOffset += 4;
+    WRITEMOTO32(pBuf, iOffset, 0x4a46 + ((uint32_t)(16 + iThumbBytes) << 16)); // JFIF
+    iOffset += 4;
+    WRITEMOTO32(pBuf, iOffset, 0x49460001);
+    iOffset += 4;
+    WRITEMOTO16(pBuf, iOffset, 0x0101); // resolution units = dots per inch
+    iOffset += 2;
+    WRITEMOTO16(pBuf, iOffset, 0); // DEBUG - store spacial resolution as 0 for now
+    iOffset += 2;
+    WRITEMOTO16(pBuf, iOffset, 0);
+    iOffset += 2;
+    pBuf[iOffset++] = pJPEG->ucThumbWidth; // thumbnail size (0x0 = none)
+    pBuf[iOffset++] = pJPEG->ucThumbHeight;
+    if (iThumbBytes) {
+        // reserve space for the RGB thumbnail; its rows are filled in as the
+        // image is encoded (see JPEGThumbRow)
+        if (pJPEG->pOutput) {
+            memset(&pBuf[iOffset], 0, iThumbBytes);
+            iOffset += iThumbBytes;
+        } else { // the file is rewritten later with pfnSeek
+            pJPEG->pfnWrite(&pJPEG->JPEGFile, pBuf, iOffset);
+            memset(pBuf, 0, pJPEG->iFileBufSize);
+            for (i = iThumbBytes; i > 0; i -= pJPEG->iFileBufSize) {
+                pJPEG->pfnWrite(&pJPEG->JPEGFile, pBuf, (i > pJPEG->iFileBufSize) ? pJPEG->iFileBufSize : i);
+            }
+            pJPEG->iDataSize = iOffset + iThumbBytes;
+            iOffset = 0;
+        }
+    }
+    // define quantization tables
+    WRITEMOTO16(pBuf, iOffset, 0xffdb); // quantization table marker
+    iOffset += 2;
+    WRITEMOTO16(pBuf, iOffset, 0x0043); // table size
+    iOffset += 2;
+    pBuf[iOffset++] = 0; // table type and number 0,8 bit
+    for (i=0; i<64; i++)
+    {
+        switch (ucQFactor) // adjust table depending on quality factor
+        {
+            default:
+            case JPEGE_Q_BEST: // best quality, divide by 4
+                pBuf[iOffset++] = quant_lum[i] >> 2;
+                break;
+            case JPEGE_Q_HIGH: // high quality, divide by 2
+                pBuf[iOffset++] = quant_lum[i] >> 1;
+                break;
+            case JPEGE_Q_MED: // medium quality factor, use values unchanged
+                pBuf[iOffset++] = quant_lum[i];
+                break;
+            case JPEGE_Q_LOW: // low quality, use values * 2
+                pBuf[iOffset++] = quant_lum[i] << 1;
+                break;
+//            case 4: // ridiculously high quality
+//                pBuf[iOffset++] = quant95_lum[i];
+//                break;
+        }
+    }
+    if (pJPEG->ucNumComponents == 3) // add color quant tables
     {
         WRITEMOTO16(pBuf, iOffset, 0xffdb); // quantization table
         iOffset += 2;
@@ -935,23 +2059,27 @@ int JPEGEncodeBegin(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, int iWidth, int iHe
             }
         }
     }
-    // store the restart interval
-    // use an interval of one MCU row
-    if (pJPEG->ucPixelType != JPEGE_PIXEL_GRAYSCALE && pJPEG->ucSubSample == JPEGE_SUBSAMPLE_420)
-        i = (pJPEG->iWidth + 15) / 16; // number of MCUs in a row
-    else
-        i = (pJPEG->iWidth + 7) / 8;
-    WRITEMOTO16(pBuf, iOffset, 0xffdd); // DRI marker
-    iOffset += 2;
-    WRITEMOTO16(pBuf, iOffset, 4); // fixed length of 4
-    iOffset += 2;
-    WRITEMOTO16(pBuf, iOffset, i); // restart interval count
-    iOffset += 2;
+    // store the restart interval (see JPEGSetRestartInterval)
+    if (pJPEG->iRestartMCUs) {
+        i = pJPEG->iRestartMCUs;
+        WRITEMOTO16(pBuf, iOffset, 0xffdd); // DRI marker
+        iOffset += 2;
+        WRITEMOTO16(pBuf, iOffset, 4); // fixed length of 4
+        iOffset += 2;
+        WRITEMOTO16(pBuf, iOffset, i); // restart interval count
+        iOffset += 2;
+    }
     
     // store the frame header
-    WRITEMOTO16(pBuf, iOffset, 0xffc0); // SOF0 marker
+    if (pJPEG->pProgArena)
+        i = 0xffc2; // SOF2 (progressive)
+    else if (pJPEG->ucArithmetic)
+        i = 0xffc9; // SOF9 (sequential, arithmetic coding)
+    else
+        i = 0xffc0; // SOF0 (baseline)
+    WRITEMOTO16(pBuf, iOffset, i);
     iOffset += 2;
-    if (pJPEG->ucPixelType == JPEGE_PIXEL_GRAYSCALE)
+    if (pJPEG->ucNumComponents == 1)
     {
         pBuf[iOffset++] = 0;
         pBuf[iOffset++] = 11; // length = 11
@@ -980,6 +2108,10 @@ int JPEGEncodeBegin(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, int iWidth, int iHe
         {
             WRITEMOTO16(pBuf, iOffset, 0x2200); // 2:1 subsampling and quant table selector
         }
+        else if (pJPEG->ucSubSample == JPEGE_SUBSAMPLE_422)
+        {
+            WRITEMOTO16(pBuf, iOffset, 0x2100); // 2:1 horizontal subsampling and quant table selector
+        }
         else
         {
             WRITEMOTO16(pBuf, iOffset, 0x1100); // no subsampling and quant table selector
@@ -992,66 +2124,70 @@ int JPEGEncodeBegin(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, int iWidth, int iHe
         WRITEMOTO16(pBuf, iOffset, 0x1101); // subsampling and quant table selector
         iOffset += 2;
     }
-    // define Huffman tables
-    WRITEMOTO16(pBuf, iOffset, 0xffc4); // Huffman DC table
-    iOffset += 2;
-    WRITEMOTO16(pBuf, iOffset, 0x1f); // Table length = 31
-    iOffset += 2;
-    pBuf[iOffset++] = 0; // table class = 0 (DC), id = 0
-    memcpy(&pBuf[iOffset], huffl_dc, 28); // copy DC table
-    iOffset += 28;
-    // now the AC table
-    WRITEMOTO16(pBuf, iOffset, 0xffc4); // Huffman AC table
-    iOffset += 2;
-    WRITEMOTO16(pBuf, iOffset, 0xb5); // Table length = 181
-    iOffset += 2;
-    pBuf[iOffset++] = 0x10; // table class = 1 (AC), id = 0
-    memcpy(&pBuf[iOffset], huffl_ac, 178); // copy AC table
-    iOffset += 178;
-    if (pJPEG->ucPixelType != JPEGE_PIXEL_GRAYSCALE) // define a second set of tables for color
-    {
-        WRITEMOTO16(pBuf, iOffset, 0xffc4); // Huffman DC table
-        iOffset += 2;
-        WRITEMOTO16(pBuf, iOffset, 0x1f); // Table length = 31
-        iOffset += 2;
-        pBuf[iOffset++] = 1; // table class = 0 (DC), id = 1
-        memcpy(&pBuf[iOffset], huffcr_dc, 28); // copy DC table
-        iOffset += 28;
-        // now the AC table
-        WRITEMOTO16(pBuf, iOffset, 0xffc4); // Huffman AC table
-        iOffset += 2;
-        WRITEMOTO16(pBuf, iOffset, 0xb5); // Table length = 181
-        iOffset += 2;
-        pBuf[iOffset++] = 0x11; // table class = 1 (AC), id = 1
-        memcpy(&pBuf[iOffset], huffcr_ac, 178); // copy AC table
-        iOffset += 178;
-    }
-    // Define the start of scan header (SOS)
-    WRITEMOTO16(pBuf, iOffset, 0xffda); // SOS
-    iOffset += 2;
-    if (pJPEG->ucPixelType == JPEGE_PIXEL_GRAYSCALE)
-    {
-        WRITEMOTO16(pBuf, iOffset, 0x8); // Table length = 8
+    // the progressive scans write their own tables (see JPEGEncodeProgressive)
+    if (pJPEG->pProgArena == NULL) {
+        if (pJPEG->ucArithmetic == 0) { // define Huffman tables (arithmetic coding uses the default conditioning)
+            WRITEMOTO16(pBuf, iOffset, 0xffc4); // Huffman DC table
+            iOffset += 2;
+            WRITEMOTO16(pBuf, iOffset, 0x1f); // Table length = 31
+            iOffset += 2;
+            pBuf[iOffset++] = 0; // table class = 0 (DC), id = 0
+            memcpy(&pBuf[iOffset], huffl_dc, 28); // copy DC table
+            iOffset += 28;
+            // now the AC table
+            WRITEMOTO16(pBuf, iOffset, 0xffc4); // Huffman AC table
+            iOffset += 2;
+            WRITEMOTO16(pBuf, iOffset, 0xb5); // Table length = 181
+            iOffset += 2;
+            pBuf[iOffset++] = 0x10; // table class = 1 (AC), id = 0
+            memcpy(&pBuf[iOffset], huffl_ac, 178); // copy AC table
+            iOffset += 178;
+            if (pJPEG->ucNumComponents == 3) // define a second set of tables for color
+            {
+                WRITEMOTO16(pBuf, iOffset, 0xffc4); // Huffman DC table
+                iOffset += 2;
+                WRITEMOTO16(pBuf, iOffset, 0x1f); // Table length = 31
+                iOffset += 2;
+                pBuf[iOffset++] = 1; // table class = 0 (DC), id = 1
+                memcpy(&pBuf[iOffset], huffcr_dc, 28); // copy DC table
+                iOffset += 28;
+                // now the AC table
+                WRITEMOTO16(pBuf, iOffset, 0xffc4); // Huffman AC table
+                iOffset += 2;
+                WRITEMOTO16(pBuf, iOffset, 0xb5); // Table length = 181
+                iOffset += 2;
+                pBuf[iOffset++] = 0x11; // table class = 1 (AC), id = 1
+                memcpy(&pBuf[iOffset], huffcr_ac, 178); // copy AC table
+                iOffset += 178;
+            }
+        }
+        // Define the start of scan header (SOS)
+        WRITEMOTO16(pBuf, iOffset, 0xffda); // SOS
         iOffset += 2;
-        pBuf[iOffset++] = 1;            // number of components in scan = 1 (grayscale)
-        pBuf[iOffset++] = 0; // component id = 0
-        pBuf[iOffset++] = 0; // dc/ac huffman table = 0/0
+        if (pJPEG->ucNumComponents == 1)
+        {
+            WRITEMOTO16(pBuf, iOffset, 0x8); // Table length = 8
+            iOffset += 2;
+            pBuf[iOffset++] = 1;            // number of components in scan = 1 (grayscale)
+            pBuf[iOffset++] = 0; // component id = 0
+            pBuf[iOffset++] = 0; // dc/ac huffman table = 0/0
+        }
+        else // color
+        {
+            WRITEMOTO16(pBuf, iOffset, 0xc); // Table length = 12
+            iOffset += 2;
+            pBuf[iOffset++] = 3;            // number of components in scan = 3 (color)
+            pBuf[iOffset++] = 0; // component id = 0
+            pBuf[iOffset++] = 0; // dc/ac huffman table = 0/0
+            pBuf[iOffset++] = 1; // component id = 1
+            pBuf[iOffset++] = 0x11; // dc/ac huffman table = 1/1
+            pBuf[iOffset++] = 2; // component id = 2
+            pBuf[iOffset++] = 0x11; // dc/ac huffman table = 1/1
+        }
+        pBuf[iOffset++] = 0; // start of spectral selection
+        pBuf[iOffset++] = 63; // end of spectral selection
+        pBuf[iOffset++] = 0; // successive approximation bit
     }
-    else // color
-    {
-        WRITEMOTO16(pBuf, iOffset, 0xc); // Table length = 12
-        iOffset += 2;
-        pBuf[iOffset++] = 3;            // number of components in scan = 3 (color)
-        pBuf[iOffset++] = 0; // component id = 0
-        pBuf[iOffset++] = 0; // dc/ac huffman table = 0/0
-        pBuf[iOffset++] = 1; // component id = 1
-        pBuf[iOffset++] = 0x11; // dc/ac huffman table = 1/1
-        pBuf[iOffset++] = 2; // component id = 2
-        pBuf[iOffset++] = 0x11; // dc/ac huffman table = 1/1
-    }
-    pBuf[iOffset++] = 0; // start of spectral selection
-    pBuf[iOffset++] = 63; // end of spectral selection
-    pBuf[iOffset++] = 0; // successive approximation bit
     // Set the output pointer for writing the variable length codes
     pJPEG->pc.pOut = &pBuf[iOffset];
     
@@ -1088,12 +2224,132 @@ int JPEGEncodeBegin(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, int iWidth, int iHe
     return JPEGE_SUCCESS;
 } /* JPEGEncodeBegin() */
 
+//
+// Rate-distortion optimized quantization of one block (see JPEGSetTrellis)
+// Each AC coefficient can take its rounded level, the level below or zero.
+// A trellis over the zigzag positions (the state is the position of the last
+// non-zero coefficient) picks the combination with the lowest
+// squared error + lambda * Huffman bits, using the code lengths of the
+// AC table that will encode the block. The DC value is rounded as usual.
+//
+int JPEGTrellisQuantize(JPEGE_IMAGE *pJPEG, signed short *pMCUSrc, int iTable)
+{
+    signed short *pQuant = (signed short *)&pJPEG->sQuantTable[iTable * DCTSIZE];
+    unsigned short *pHuff = (unsigned short *)pJPEG->huffdc[iTable] + 512; // AC codes; lengths are at +256
+    const int iLambda = pJPEG->usLambda;
+    int iCost[DCTSIZE], iZero[DCTSIZE]; // best cost ending at each position, sum of zeroed errors
+    int iPrev[DCTSIZE];
+    signed short sLevel[DCTSIZE], sOut[DCTSIZE];
+    int i, j, k, d, q, q0, iRun, iSize, iBits, iErr, iDist, iBest, iLast;
+
+    d = pMCUSrc[0]; // DC, same rounding as JPEGQuantize()
+    q = (((pQuant[0] >> 1) + ((d < 0) ? -d : d)) * pQuant[128]) >> 16;
+    pMCUSrc[0] = (signed short)((d < 0) ? -q : q);
+    iCost[0] = iZero[0] = 0;
+    for (k=1; k<DCTSIZE; k++) {
+        i = cZigZag2[k];
+        d = pMCUSrc[i];
+        if (d < 0) d = -d;
+        iErr = (d << 11) / iScaleBits[i]; // error of 0, scaled back to the JPEG DCT range
+        iZero[k] = iZero[k-1] + iErr * iErr;
+        q0 = (((pQuant[i] >> 1) + d) * pQuant[i + 128]) >> 16; // rounded level
+        iCost[k] = 0x7fffffff;
+        for (q = q0; q > 0 && q >= q0 - 1; q--) { // candidate levels
+            iErr = ((d - q * pQuant[i]) * 2048) / iScaleBits[i];
+            iDist = iErr * iErr;
+            for (iSize = 1; (q >> iSize); iSize++) {};
+            for (j = 0; j < k; j++) { // previous non-zero position
+                if (iCost[j] == 0x7fffffff) continue;
+                iRun = k - j - 1;
+                iBits = pHuff[256 + ((iRun & 15) << 4) + iSize] + iSize + (iRun >> 4) * pHuff[256 + 0xf0];
+                iBest = iCost[j] + (iZero[k-1] - iZero[j]) + iDist + iLambda * iBits;
+                if (iBest < iCost[k]) {
+                    iCost[k] = iBest;
+                    iPrev[k] = j;
+                    sLevel[k] = (signed short)q;
+                }
+            }
+        }
+    }
+    // pick the last non-zero coefficient; the rest is coded with an EOB
+    iBest = iZero[DCTSIZE-1] + iLambda * pHuff[256];
+    iLast = 0;
+    for (k=1; k<pJPEG->ucROIKeep; k++) { // the rest is outside the region of interest
+        if (iCost[k] == 0x7fffffff) continue;
+        j = iCost[k] + (iZero[DCTSIZE-1] - iZero[k]) + ((k < DCTSIZE-1) ? iLambda * pHuff[256] : 0);
+        if (j < iBest) {
+            iBest = j;
+            iLast = k;
+        }
+    }
+    memset(sOut, 0, sizeof(sOut));
+    j = (iLast < 32); // sparse; JPEGEncodeMCU() stops before zigzag position 33
+    for (k = iLast; k > 0; k = iPrev[k]) { // follow the chosen path back
+        i = cZigZag2[k];
+        sOut[i] = (pMCUSrc[i] < 0) ? -sLevel[k] : sLevel[k];
+    }
+    memcpy(&pMCUSrc[1], &sOut[1], (DCTSIZE-1) * sizeof(signed short));
+    return j;
+} /* JPEGTrellisQuantize() */
+
+//
+// Quantize one block with a wider zero bin and drop the isolated +/-1
+// AC coefficients that sensor noise leaves behind (see JPEGSetDeadZone)
+// The importance of the current MCU (see JPEGSetROI) can widen the zero bin
+// further and drop the coefficients from zigzag position ucROIKeep on
+//
+int JPEGDeadZoneQuantize(JPEGE_IMAGE *pJPEG, signed short *pMCUSrc, int iTable)
+{
+    signed short *pQuant = (signed short *)&pJPEG->sQuantTable[iTable * DCTSIZE];
+    const int iZeroBin = 8 + ((pJPEG->ucROIDeadZone > pJPEG->ucDeadZone[iTable]) ? pJPEG->ucROIDeadZone : pJPEG->ucDeadZone[iTable]); // in 1/16ths of Q
+    const int iIsolated = pJPEG->ucIsolated[iTable];
+    const int iKeep = pJPEG->ucROIKeep;
+    int i, j, k, d, q, iRun, iLast;
+
+    for (i=0; i<DCTSIZE; i++) {
+        d = pMCUSrc[i];
+        if (d < 0) d = -d;
+        if (i != 0 && (d << 4) < pQuant[i] * iZeroBin)
+            q = 0;
+        else
+            q = (((pQuant[i] >> 1) + d) * pQuant[i + 128]) >> 16;
+        pMCUSrc[i] = (signed short)((pMCUSrc[i] < 0) ? -q : q);
+    }
+    iRun = iLast = 0;
+    for (k=1; k<DCTSIZE; k++) { // zigzag order, counting zeros before each coefficient
+        i = cZigZag2[k];
+        if (k >= iKeep)
+            pMCUSrc[i] = 0; // outside the region of interest
+        if (pMCUSrc[i] == 0) {
+            iRun++;
+            continue;
+        }
+        if (iIsolated && iRun >= iIsolated && (pMCUSrc[i] == 1 || pMCUSrc[i] == -1)) {
+            for (j=k+1; j<DCTSIZE && j<=k+iIsolated; j++) { // zeros after it?
+                if (pMCUSrc[cZigZag2[j]]) break;
+            }
+            if (j == DCTSIZE || j > k+iIsolated) {
+                pMCUSrc[i] = 0;
+                iRun++;
+                continue;
+            }
+        }
+        iRun = 0;
+        iLast = k;
+    }
+    return (iLast < 32); // sparse; JPEGEncodeMCU() stops before zigzag position 33
+} /* JPEGDeadZoneQuantize() */
+
 int JPEGQuantize(JPEGE_IMAGE *pJPEG, signed short *pMCUSrc, int iTable)
 {
     signed int d, sQ1, sQ2, sum;
     int i;
     signed short *pQuant;
     
+    if (pJPEG->usLambda)
+        return JPEGTrellisQuantize(pJPEG, pMCUSrc, iTable);
+    if (pJPEG->ucDeadZone[iTable] | pJPEG->ucIsolated[iTable] | pJPEG->ucROIDeadZone || pJPEG->ucROIKeep < DCTSIZE)
+        return JPEGDeadZoneQuantize(pJPEG, pMCUSrc, iTable);
     pQuant = (signed short *)&pJPEG->sQuantTable[iTable * DCTSIZE];
     for (i=0; i<33; i++) // do first half and then check for second half being all 0's
     {
@@ -1134,7 +2390,30 @@ int JPEGQuantize(JPEGE_IMAGE *pJPEG, signed short *pMCUSrc, int iTable)
     return (sum == 0); // if the last half of the quantized results was 0, call it 'sparse'
 } /* JPEGQuantize() */
 
-int JPEGEncodeMCU(int iDCTable, JPEGE_IMAGE *pJPEG, signed short *pMCUData, int iDCPred, int bSparse)
+//
+// Note where the first DC code of a component starts in a segment
+// (see JPEGSegmentBegin). It's coded against a predictor of 0 and gets
+// replaced when the segments are spliced. The position is counted without
+// the stuffed 0 bytes, which are removed at the end of the segment.
+//
+void JPEGSegmentMark(JPEGE_IMAGE *pJPEG, int iComponent, int iDC)
+{
+    JPEGE_SEGMENT *pSeg = pJPEG->pSegment;
+    uint8_t *p;
+    int iStuffed = 0;
+
+    for (p = pJPEG->pOutput; p < pJPEG->pc.pOut; p++) { // only the first MCU, so this is short
+        if (p[0] == 0xff) {
+            p++;
+            iStuffed++;
+        }
+    }
+    pSeg->iDCBit[iComponent] = (int)(pJPEG->pc.pOut - pJPEG->pOutput - iStuffed) * 8 + (int)pJPEG->pc.iLen;
+    pSeg->iFirstDC[iComponent] = iDC;
+    pJPEG->ucSegFirst &= ~(1 << iComponent);
+} /* JPEGSegmentMark() */
+
+int JPEGEncodeMCU(int iComponent, JPEGE_IMAGE *pJPEG, signed short *pMCUData, int iDCPred, int bSparse)
 {
     //int iOff, iBitnum; // faster access
     unsigned char cMagnitude;
@@ -1149,6 +2428,10 @@ int JPEGEncodeMCU(int iDCTable, JPEGE_IMAGE *pJPEG, signed short *pMCUData, int
     uint32_t ulMagVal;
     uint32_t *pMagFix = (uint32_t *)&ulMagnitudeFix[1024]; // allows indexing positive and negative values - speeds up total encode time by 15%
     
+    if (pJPEG->ucArithmetic) // same blocks, different entropy coder
+        return JPEGArithEncodeMCU(iComponent, pJPEG, pMCUData, iDCPred, bSparse);
+    if (pJPEG->ucSegFirst & (1 << iComponent))
+        JPEGSegmentMark(pJPEG, iComponent, pMCUData[0]);
     // Put in local vars to allow compiler to do a better job of optimization using registers
     ulAcc = pJPEG->pc.ulAcc;
     pOut = pJPEG->pc.pOut;
@@ -1157,7 +2440,7 @@ int JPEGEncodeMCU(int iDCTable, JPEGE_IMAGE *pJPEG, signed short *pMCUData, int
     // compress the DC component
     iDelta = pMCUData[0] - iDCPred;
     iDCPred = pMCUData[0]; // this is the new DC value
-    pHuff = (unsigned short *) pJPEG->huffdc[iDCTable];
+    pHuff = (unsigned short *) pJPEG->huffdc[(iComponent) ? 1 : 0];
     ulMagVal = pMagFix[iDelta]; // get magnitude and new delta in one table read
     iDelta = (ulMagVal >> 16);
     cMagnitude = ulMagVal & 0xf;
@@ -1233,8 +2516,18 @@ encodemcuz:
 
 void JPEGGetMCU(unsigned char *pSrc, int iPitch, signed char *pMCU)
 {
-    int cy;
+    int cx, cy;
     
+    if (((intptr_t)pSrc | iPitch) & 3) { // unaligned source (e.g. a cropped image)
+        for (cy = 0; cy < 8; cy++) {
+            for (cx = 0; cx < 8; cx++) {
+                pMCU[cx] = (signed char)(pSrc[cx] ^ 0x80);
+            }
+            pMCU += 8;
+            pSrc += iPitch;
+        }
+        return;
+    }
     for (cy = 0; cy < 8; cy++) {
         *(uint32_t *)pMCU = *(uint32_t *)pSrc ^ 0x80808080;
         *(uint32_t *)&pMCU[4] = *(uint32_t *)&pSrc[4] ^ 0x80808080;
@@ -1243,8 +2536,9 @@ void JPEGGetMCU(unsigned char *pSrc, int iPitch, signed char *pMCU)
     }
 } /* JPEGGetMCU() */
 
-void JPEGSubSample24(unsigned char *pSrc, signed char *pLUM, signed char *pCb, signed char *pCr, int lsize, int cx, int cy)
+void JPEGSubSample24(unsigned char *pSrc, signed char *pLUM, signed char *pCb, signed char *pCr, int lsize, int cx, int cy, int iRed)
 {
+    int iBlue = iRed ^ 2; // red and blue can be swapped
     int x;
     unsigned char cRed, cGreen, cBlue;
     int iY1, iY2, iY3, iY4, iCr1, iCr2, iCr3, iCr4, iCb1, iCb2, iCb3, iCb4;
@@ -1257,30 +2551,30 @@ void JPEGSubSample24(unsigned char *pSrc, signed char *pLUM, signed char *pCb, s
     {
         for (x = 0; x<cx; x++) // do 8x8 pixels in 2x2 blocks
         {
-            cBlue = pSrc[0];
+            cBlue = pSrc[iBlue];
             cGreen = pSrc[1];
-            cRed = pSrc[2];
+            cRed = pSrc[iRed];
             iY1 = (((cRed * 1225) + (cGreen * 2404) + (cBlue * 467)) >> 12) - 0x80;
             iCb1 = (cBlue << 11) + (cRed * -691) + (cGreen * -1357);
             iCr1 = (cRed << 11) + (cGreen * -1715) + (cBlue * -333);
             
-            cBlue = pSrc[3];
+            cBlue = pSrc[3+iBlue];
             cGreen = pSrc[4];
-            cRed = pSrc[5];
+            cRed = pSrc[3+iRed];
             iY2 = (((cRed * 1225) + (cGreen * 2404) + (cBlue * 467)) >> 12) - 0x80;
             iCb2 = (cBlue << 11) + (cRed * -691) + (cGreen * -1357);
             iCr2 = (cRed << 11) + (cGreen * -1715) + (cBlue * -333);
             
-            cBlue = pSrc[lsize];
+            cBlue = pSrc[lsize+iBlue];
             cGreen = pSrc[lsize+1];
-            cRed = pSrc[lsize+2];
+            cRed = pSrc[lsize+iRed];
             iY3 = (((cRed * 1225) + (cGreen * 2404) + (cBlue * 467)) >> 12) - 0x80;
             iCb3 = (cBlue << 11) + (cRed * -691) + (cGreen * -1357);
             iCr3 = (cRed << 11) + (cGreen * -1715) + (cBlue * -333);
             
-            cBlue = pSrc[lsize+3];
+            cBlue = pSrc[lsize+3+iBlue];
             cGreen = pSrc[lsize+4];
-            cRed = pSrc[lsize+5];
+            cRed = pSrc[lsize+3+iRed];
             iY4 = (((cRed * 1225) + (cGreen * 2404) + (cBlue * 467)) >> 12) - 0x80;
             iCb4 = (cBlue << 11) + (cRed * -691) + (cGreen * -1357);
             iCr4 = (cRed << 11) + (cGreen * -1715) + (cBlue * -333);
@@ -1308,7 +2602,7 @@ void JPEGSubSample24(unsigned char *pSrc, signed char *pLUM, signed char *pCb, s
     } // for y
     
 } /* JPEGSubSample24() */
-void JPEGSubSample16(unsigned char *pSrc, signed char *pLUM, signed char *pCb, signed char *pCr, int lsize, int cx, int cy)
+void JPEGSubSample16(unsigned char *pSrc, signed char *pLUM, signed char *pCb, signed char *pCr, int lsize, int cx, int cy, int bBigEndian)
 {
     int x, y;
     unsigned short us;
@@ -1324,6 +2618,7 @@ void JPEGSubSample16(unsigned char *pSrc, signed char *pLUM, signed char *pCb, s
         for (x=0; x<cx; x++) // do 8x8 pixels in 2x2 blocks
         {
             us = pUS[0];
+            if (bBigEndian) us = (unsigned short)((us >> 8) | (us << 8));
             cBlue = (unsigned char)(((us & 0x1f)<<3) | (us & 7));
             cGreen = (unsigned char)(((us & 0x7e0)>>3) | ((us & 0x60)>>5));
             cRed = (unsigned char)(((us & 0xf800)>>8) | ((us & 0x3800)>>11));
@@ -1332,6 +2627,7 @@ void JPEGSubSample16(unsigned char *pSrc, signed char *pLUM, signed char *pCb, s
             iCr1 = (cRed << 11) + (cGreen * -1715) + (cBlue * -333);
             
             us = pUS[1];
+            if (bBigEndian) us = (unsigned short)((us >> 8) | (us << 8));
             cBlue = (unsigned char)(((us & 0x1f)<<3) | (us & 7));
             cGreen = (unsigned char)(((us & 0x7e0)>>3) | ((us & 0x60)>>5));
             cRed = (unsigned char)(((us & 0xf800)>>8) | ((us & 0x3800)>>11));
@@ -1340,6 +2636,7 @@ void JPEGSubSample16(unsigned char *pSrc, signed char *pLUM, signed char *pCb, s
             iCr2 = (cRed << 11) + (cGreen * -1715) + (cBlue * -333);
             
             us = pUS[lsize>>1];
+            if (bBigEndian) us = (unsigned short)((us >> 8) | (us << 8));
             cBlue = (unsigned char)(((us & 0x1f)<<3) | (us & 7));
             cGreen = (unsigned char)(((us & 0x7e0)>>3) | ((us & 0x60)>>5));
             cRed = (unsigned char)(((us & 0xf800)>>8) | ((us & 0x3800)>>11));
@@ -1348,6 +2645,7 @@ void JPEGSubSample16(unsigned char *pSrc, signed char *pLUM, signed char *pCb, s
             iCr3 = (cRed << 11) + (cGreen * -1715) + (cBlue * -333);
             
             us = pUS[(lsize>>1)+1];
+            if (bBigEndian) us = (unsigned short)((us >> 8) | (us << 8));
             cBlue = (unsigned char)(((us & 0x1f)<<3) | (us & 7));
             cGreen = (unsigned char)(((us & 0x7e0)>>3) | ((us & 0x60)>>5));
             cRed = (unsigned char)(((us & 0xf800)>>8) | ((us & 0x3800)>>11));
@@ -1379,8 +2677,9 @@ void JPEGSubSample16(unsigned char *pSrc, signed char *pLUM, signed char *pCb, s
     
 } /* JPEGSubSample16() */
 
-void JPEGSubSample32(unsigned char *pSrc, signed char *pLUM, signed char *pCb, signed char *pCr, int lsize, int cx, int cy)
+void JPEGSubSample32(unsigned char *pSrc, signed char *pLUM, signed char *pCb, signed char *pCr, int lsize, int cx, int cy, int iRed)
 {
+    int iBlue = iRed ^ 2; // red and blue can be swapped
     int x;
     unsigned char cRed, cGreen, cBlue;
     int iY1, iY2, iY3, iY4, iCr1, iCr2, iCr3, iCr4, iCb1, iCb2, iCb3, iCb4;
@@ -1393,30 +2692,30 @@ void JPEGSubSample32(unsigned char *pSrc, signed char *pLUM, signed char *pCb, s
     {
         for (x=0; x<cx; x++) // do 8x8 pixels in 2x2 blocks
         {
-            cRed = pSrc[0];
+            cRed = pSrc[iRed];
             cGreen = pSrc[1];
-            cBlue = pSrc[2];
+            cBlue = pSrc[iBlue];
             iY1 = (((cRed * 1225) + (cGreen * 2404) + (cBlue * 467)) >> 12) - 0x80;
             iCb1 = (cBlue << 11) + (cRed * -691) + (cGreen * -1357);
             iCr1 = (cRed << 11) + (cGreen * -1715) + (cBlue * -333);
 
-            cRed = pSrc[4];
+            cRed = pSrc[4+iRed];
             cGreen = pSrc[5];
-            cBlue = pSrc[6];
+            cBlue = pSrc[4+iBlue];
             iY2 = (((cRed * 1225) + (cGreen * 2404) + (cBlue * 467)) >> 12) - 0x80;
             iCb2 = (cBlue << 11) + (cRed * -691) + (cGreen * -1357);
             iCr2 = (cRed << 11) + (cGreen * -1715) + (cBlue * -333);
 
-            cRed = pSrc[lsize+0];
+            cRed = pSrc[lsize+iRed];
             cGreen = pSrc[lsize+1];
-            cBlue = pSrc[lsize+2];
+            cBlue = pSrc[lsize+iBlue];
             iY3 = (((cRed * 1225) + (cGreen * 2404) + (cBlue * 467)) >> 12) - 0x80;
             iCb3 = (cBlue << 11) + (cRed * -691) + (cGreen * -1357);
             iCr3 = (cRed << 11) + (cGreen * -1715) + (cBlue * -333);
 
-            cRed = pSrc[lsize+4];
+            cRed = pSrc[lsize+4+iRed];
             cGreen = pSrc[lsize+5];
-            cBlue = pSrc[lsize+6];
+            cBlue = pSrc[lsize+4+iBlue];
             iY4 = (((cRed * 1225) + (cGreen * 2404) + (cBlue * 467)) >> 12) - 0x80;
             iCb4 = (cBlue << 11) + (cRed * -691) + (cGreen * -1357);
             iCr4 = (cRed << 11) + (cGreen * -1715) + (cBlue * -333);
@@ -1445,7 +2744,7 @@ void JPEGSubSample32(unsigned char *pSrc, signed char *pLUM, signed char *pCb, s
 
 } /* JPEGSubSample32() */
 
-void JPEGSample32(unsigned char *pSrc, signed char *pMCU, int lsize, int cx, int cy)
+void JPEGSample32(unsigned char *pSrc, signed char *pMCU, int lsize, int cx, int cy, int iRed)
 {
     int x, y;
     unsigned char cRed, cGreen, cBlue;
@@ -1455,9 +2754,9 @@ void JPEGSample32(unsigned char *pSrc, signed char *pMCU, int lsize, int cx, int
     {
         for (x=0; x<cx; x++) // do 8x8 pixels
         {
-            cRed = pSrc[0];
+            cRed = pSrc[iRed];
             cGreen = pSrc[1];
-            cBlue = pSrc[2];
+            cBlue = pSrc[iRed ^ 2];
             pSrc += 4;
             iY = (((cRed * 1225) + (cGreen * 2404) + (cBlue * 467)) >> 12) - 0x80;
             iCb = (cBlue << 11) + (cRed * -691) + (cGreen * -1357);
@@ -1475,58 +2774,61 @@ void JPEGSample32(unsigned char *pSrc, signed char *pMCU, int lsize, int cx, int
 } /* JPEGSample32() */
 
 //
-// U0 Y0 V0 Y1 U2 Y2 V2 Y3...
-// The bytes coming from the GC0308 are reversed, 0=Y0, 1=U0, 2=Y1, etc
+// Y0 U0 Y1 V0 Y2 U2 Y3 V2... (or one of the other packed 4:2:2 byte orders)
+// The bytes coming from the GC0308 are in this order, 0=Y0, 1=U0, 2=Y1, etc
 // assumes that the YUV422 will be converted to 4:2:0 subsampling
 // YUV422 is horizontally subsampled; this code takes the average of each
 // vertical pair of Cb/Cr and creates 4:2:0 from it
 //
-void JPEGSubSampleYUV422(uint8_t *pImage, int8_t *pMCUData, int iPitch)
+void JPEGSubSampleYUV422(uint8_t *pImage, int8_t *pMCUData, int iPitch, uint8_t ucPixelType)
 {
 int x, y;
 uint8_t *pY0, *pY1, *pY2, *pY3;
 uint8_t *pCr, *pCb;
 uint8_t *s = pImage;
+uint8_t *sY, *sU, *sV;
+const uint8_t *pOffsets = ucYUVOffsets[ucPixelType - JPEGE_PIXEL_YUV422];
 int iCr, iCb;
 uint32_t *pU32;
 
   // output bins for YCbCr 
     pY0 = (uint8_t *)pMCUData; pY1 = (uint8_t *)&pMCUData[64*1];
     pY2 = (uint8_t *)&pMCUData[64*2]; pY3 = (uint8_t *)&pMCUData[64*3];
-    pCr = (uint8_t *)&pMCUData[64*4]; pCb = (uint8_t *)&pMCUData[64*5];
+    pCb = (uint8_t *)&pMCUData[64*4]; pCr = (uint8_t *)&pMCUData[64*5];
 
   // subsample the UV vertically to get 4:2:0 from 4:2:2
     for (y=0; y<4; y ++) { // do 4 quadrants of 2x2 blocks of pixels at a time
         for (x=0; x<4; x++) {
-            pY0[0] = s[0]; pY0[1] = s[2]; // top left
-            pY0[8] = s[iPitch]; pY0[9] = s[iPitch+2];
+            sY = s + pOffsets[0]; sU = s + pOffsets[1]; sV = s + pOffsets[2];
+            pY0[0] = sY[0]; pY0[1] = sY[2]; // top left
+            pY0[8] = sY[iPitch]; pY0[9] = sY[iPitch+2];
 
-            pY1[0] = s[16]; pY1[1] = s[18]; // top right
-            pY1[8] = s[iPitch+16]; pY1[9] = s[iPitch+18];
+            pY1[0] = sY[16]; pY1[1] = sY[18]; // top right
+            pY1[8] = sY[iPitch+16]; pY1[9] = sY[iPitch+18];
 
-            pY2[0] = s[(iPitch*8)+0]; pY2[1] = s[(iPitch*8)+2]; // bottom left
-            pY2[8] = s[(iPitch*9)+0]; pY2[9] = s[(iPitch*9)+2];
+            pY2[0] = sY[(iPitch*8)+0]; pY2[1] = sY[(iPitch*8)+2]; // bottom left
+            pY2[8] = sY[(iPitch*9)+0]; pY2[9] = sY[(iPitch*9)+2];
 
-            pY3[0] = s[(iPitch*8)+16]; pY3[1] = s[(iPitch*8)+18]; // bottom right
-            pY3[8] = s[(iPitch*9)+16]; pY3[9] = s[(iPitch*9)+18];
+            pY3[0] = sY[(iPitch*8)+16]; pY3[1] = sY[(iPitch*8)+18]; // bottom right
+            pY3[8] = sY[(iPitch*9)+16]; pY3[9] = sY[(iPitch*9)+18];
 
-            iCr = (s[1] + s[iPitch+1] + 1)/2; // subsample vertically
-            iCb = (s[3] + s[iPitch+3] + 1)/2;
-            pCr[0] = (int8_t)(iCr);
+            iCb = (sU[0] + sU[iPitch] + 1)/2; // subsample vertically
+            iCr = (sV[0] + sV[iPitch] + 1)/2;
             pCb[0] = (int8_t)(iCb);
-            iCr = (s[17] + s[iPitch+17] + 1)/2; // subsample vertically
-            iCb = (s[19] + s[iPitch+19] + 1)/2;
-            pCr[4] = (int8_t)(iCr);
+            pCr[0] = (int8_t)(iCr);
+            iCb = (sU[16] + sU[iPitch+16] + 1)/2; // subsample vertically
+            iCr = (sV[16] + sV[iPitch+16] + 1)/2;
             pCb[4] = (int8_t)(iCb);
+            pCr[4] = (int8_t)(iCr);
 
-            iCr = (s[(iPitch*8)+1] + s[(iPitch*9)+1] + 1)/2; // subsample vertically
-            iCb = (s[(iPitch*8)+3] + s[(iPitch*9)+3] + 1)/2;
-            pCr[32] = (int8_t)(iCr);
+            iCb = (sU[iPitch*8] + sU[iPitch*9] + 1)/2; // subsample vertically
+            iCr = (sV[iPitch*8] + sV[iPitch*9] + 1)/2;
             pCb[32] = (int8_t)(iCb);
-            iCr = (s[(iPitch*8)+17] + s[(iPitch*9)+17] + 1)/2; // subsample vertically
-            iCb = (s[(iPitch*8)+19] + s[(iPitch*9)+19] + 1)/2;
-            pCr[36] = (int8_t)(iCr);
+            pCr[32] = (int8_t)(iCr);
+            iCb = (sU[(iPitch*8)+16] + sU[(iPitch*9)+16] + 1)/2; // subsample vertically
+            iCr = (sV[(iPitch*8)+16] + sV[(iPitch*9)+16] + 1)/2;
             pCb[36] = (int8_t)(iCb);
+            pCr[36] = (int8_t)(iCr);
 
             pCr++; pCb++;
             pY0 += 2; pY1 += 2; pY2 += 2; pY3 += 2;
@@ -1544,85 +2846,66 @@ uint32_t *pU32;
     }
 } /* JPEGSubSampleYUV422() */
 
-void JPEGGetMCU22(unsigned char *pImage, JPEGE_IMAGE *pPage, int iPitch)
+void JPEGGetMCU22(unsigned char *pImage, JPEGE_IMAGE *pPage, int iPitch, uint8_t ucPixelType)
 {
-    int cx, cy, width, height;
+    int cx, cy, width, height, iOrder;
     signed char *pMCUData = pPage->MCUc;
-//    if (pPage->ucPixelType == JPEGE_PIXEL_RGB565)
-//        pSrc = pImage + x*16*2 + (y * 16 * lsize);
-//    else if (pPage->ucPixelType == JPEGE_PIXEL_RGB888)
-//        pSrc = pImage + x*16*3 + (y * 16 * lsize);
-//    else if (pPage->ucPixelType == JPEGE_PIXEL_ARGB8888)
-//        pSrc = pImage + x*16*4 + (y * 16 * lsize);
-//    else
-//        return; // invalid bit depth
-    //    pDest = pMCUData;
+    // partial edge MCUs have already been padded to full size by JPEGPadMCU()
     cx = cy = 8;
     width = height = 16;
-//    if (x*16 + width > pPage->iWidth)
-//        width = pPage->iWidth & 15;
-//    if (y*16 + height > pPage->iHeight)
-//        height = pPage->iHeight & 15;
-//    if (width < 8)
-//        cx = width;
-//    else
-//        cx = 8;
-//    if (height < 8)
-//        cy = height;
-//    else
-//        cy = 8;
-//    if (cy != 8 || cx != 8) // for edge MCUs, make sure all unused slots are 0
-//        memset(pMCUData, 0, 6*64*sizeof(short));
-    if (pPage->ucPixelType == JPEGE_PIXEL_YUV422) // U0 Y0 V0 Y1 U2 Y2 V2 Y3
+    if (JPEGE_IS_PACKED422(ucPixelType)) // Y0 U0 Y1 V0 Y2 U2 Y3 V2 (or similar)
     {
-        JPEGSubSampleYUV422(pImage, pMCUData, iPitch);
+        JPEGSubSampleYUV422(pImage, pMCUData, iPitch, ucPixelType);
     }
-    else if (pPage->ucPixelType == JPEGE_PIXEL_RGB565)
+    else if (ucPixelType == JPEGE_PIXEL_RGB565 || ucPixelType == JPEGE_PIXEL_RGB565_BE)
     {
+        iOrder = (ucPixelType == JPEGE_PIXEL_RGB565_BE); // byte swapped
         // upper left
-        JPEGSubSample16(pImage, pMCUData, &pMCUData[DCTSIZE*4], &pMCUData[DCTSIZE*5], iPitch, cx, cy);
+        JPEGSubSample16(pImage, pMCUData, &pMCUData[DCTSIZE*4], &pMCUData[DCTSIZE*5], iPitch, cx, cy, iOrder);
         // upper right
         if (width > 8)
-            JPEGSubSample16(pImage+8*2, &pMCUData[DCTSIZE*1], &pMCUData[4+DCTSIZE*4], &pMCUData[4+DCTSIZE*5], iPitch, width-8, cy);
+            JPEGSubSample16(pImage+8*2, &pMCUData[DCTSIZE*1], &pMCUData[4+DCTSIZE*4], &pMCUData[4+DCTSIZE*5], iPitch, width-8, cy, iOrder);
         if (height > 8)
         {
             // lower left
-            JPEGSubSample16(pImage+8*iPitch, &pMCUData[DCTSIZE*2], &pMCUData[32+DCTSIZE*4], &pMCUData[32+DCTSIZE*5], iPitch, cx, height - 8);
+            JPEGSubSample16(pImage+8*iPitch, &pMCUData[DCTSIZE*2], &pMCUData[32+DCTSIZE*4], &pMCUData[32+DCTSIZE*5], iPitch, cx, height - 8, iOrder);
             // lower right
             if (width > 8)
-                JPEGSubSample16(pImage+8*iPitch + 8*2, &pMCUData[DCTSIZE*3], &pMCUData[36+DCTSIZE*4], &pMCUData[36+DCTSIZE*5], iPitch, width - 8, height - 8);
+                JPEGSubSample16(pImage+8*iPitch + 8*2, &pMCUData[DCTSIZE*3], &pMCUData[36+DCTSIZE*4], &pMCUData[36+DCTSIZE*5], iPitch, width - 8, height - 8, iOrder);
         }
     }
-    else if (pPage->ucPixelType == JPEGE_PIXEL_RGB888)
+    else if (ucPixelType == JPEGE_PIXEL_RGB888 || ucPixelType == JPEGE_PIXEL_BGR888)
     {
+        iOrder = (ucPixelType == JPEGE_PIXEL_BGR888) ? 0 : 2; // offset of red
         // upper left
-        JPEGSubSample24(pImage, pMCUData, &pMCUData[DCTSIZE*4], &pMCUData[DCTSIZE*5], iPitch, cx, cy);
+        JPEGSubSample24(pImage, pMCUData, &pMCUData[DCTSIZE*4], &pMCUData[DCTSIZE*5], iPitch, cx, cy, iOrder);
         // upper right
         if (width > 8)
-            JPEGSubSample24(pImage+8*3, &pMCUData[DCTSIZE*1], &pMCUData[4+DCTSIZE*4], &pMCUData[4+DCTSIZE*5], iPitch, width-8, cy);
+            JPEGSubSample24(pImage+8*3, &pMCUData[DCTSIZE*1], &pMCUData[4+DCTSIZE*4], &pMCUData[4+DCTSIZE*5], iPitch, width-8, cy, iOrder);
         if (height > 8)
         {
             // lower left
-            JPEGSubSample24(pImage+8*iPitch, &pMCUData[DCTSIZE*2], &pMCUData[32+DCTSIZE*4], &pMCUData[32+DCTSIZE*5], iPitch, cx, height - 8);
+            JPEGSubSample24(pImage+8*iPitch, &pMCUData[DCTSIZE*2], &pMCUData[32+DCTSIZE*4], &pMCUData[32+DCTSIZE*5], iPitch, cx, height - 8, iOrder);
             // lower right
             if (width > 8)
-                JPEGSubSample24(pImage+8*iPitch + 8*3, &pMCUData[DCTSIZE*3], &pMCUData[36+DCTSIZE*4], &pMCUData[36+DCTSIZE*5], iPitch, width - 8, height - 8);
+                JPEGSubSample24(pImage+8*iPitch + 8*3, &pMCUData[DCTSIZE*3], &pMCUData[36+DCTSIZE*4], &pMCUData[36+DCTSIZE*5], iPitch, width - 8, height - 8, iOrder);
         }
     }
-    else if (pPage->ucPixelType == JPEGE_PIXEL_ARGB8888)
+    else if (ucPixelType == JPEGE_PIXEL_ARGB8888 || ucPixelType == JPEGE_PIXEL_BGRA8888)
     {
+        iOrder = (ucPixelType == JPEGE_PIXEL_BGRA8888) ? 2 : 0; // offset of red
         // upper left
-        JPEGSubSample32(pImage, pMCUData, &pMCUData[DCTSIZE*4], &pMCUData[DCTSIZE*5], iPitch, cx, cy);
+        JPEGSubSample32(pImage, pMCUData, &pMCUData[DCTSIZE*4], &pMCUData[DCTSIZE*5], iPitch, cx, cy, iOrder);
         // upper right
         if (width > 8)
-            JPEGSubSample32(pImage+8*4, &pMCUData[DCTSIZE*1], &pMCUData[4+DCTSIZE*4], &pMCUData[4+DCTSIZE*5], iPitch, width-8, cy);
+            JPEGSubSample32(pImage+8*4, &pMCUData[DCTSIZE*1], &pMCUData[4+DCTSIZE*4], &pMCUData[4+DCTSIZE*5], iPitch, width-8, cy, iOrder);
         if (height > 8)
         {
             // lower left
-            JPEGSubSample32(pImage+8*iPitch, &pMCUData[DCTSIZE*2], &pMCUData[32+DCTSIZE*4], &pMCUData[32+DCTSIZE*5], iPitch, cx, height - 8);
+            JPEGSubSample32(pImage+8*iPitch, &pMCUData[DCTSIZE*2], &pMCUData[32+DCTSIZE*4], &pMCUData[32+DCTSIZE*5], iPitch, cx, height - 8, iOrder);
             // lower right
             if (width > 8)
-                JPEGSubSample32(pImage+8*iPitch + 8*4, &pMCUData[DCTSIZE*3], &pMCUData[36+DCTSIZE*4], &pMCUData[36+DCTSIZE*5], iPitch, width - 8, height - 8);
+                JPEGSubSample32(pImage+8*iPitch + 8*4, &pMCUData[DCTSIZE*3], &pMCUData[36+DCTSIZE*4], &pMCUData[36+DCTSIZE*5], iPitch, width - 8, height - 8, iOrder);
         }
     }
 } /* JPEGGetMCU22() */
@@ -1634,7 +2917,7 @@ void JPEGGetMCU22(unsigned char *pImage, JPEGE_IMAGE *pPage, int iPitch)
  *  PURPOSE    : Sample a 8x8 color block                                   *
  *                                                                          *
  ****************************************************************************/
-void JPEGSample16(unsigned char *pSrc, signed char *pMCU, int lsize, int cx, int cy)
+void JPEGSample16(unsigned char *pSrc, signed char *pMCU, int lsize, int cx, int cy, int bBigEndian)
 {
     int x, y;
     unsigned short us;
@@ -1647,6 +2930,7 @@ void JPEGSample16(unsigned char *pSrc, signed char *pMCU, int lsize, int cx, int
         for (x=0; x<cx; x++) // do 8x8 pixels
         {
             us = *pUS++;
+            if (bBigEndian) us = (unsigned short)((us >> 8) | (us << 8));
             cBlue = (unsigned char)(((us & 0x1f)<<3) | (us & 7));
             cGreen = (unsigned char)(((us & 0x7e0)>>3) | ((us & 0x60)>>5));
             cRed = (unsigned char)(((us & 0xf800)>>8) | ((us & 0x3800)>>11));
@@ -1672,7 +2956,7 @@ void JPEGSample16(unsigned char *pSrc, signed char *pMCU, int lsize, int cx, int
  *  PURPOSE    : Sample a 8x8 color block                                   *
  *                                                                          *
  ****************************************************************************/
-void JPEGSample24(unsigned char *pSrc, signed char *pMCU, int lsize, int cx, int cy)
+void JPEGSample24(unsigned char *pSrc, signed char *pMCU, int lsize, int cx, int cy, int iRed)
 {
     int x;
     unsigned char cRed, cGreen, cBlue;
@@ -1683,9 +2967,10 @@ void JPEGSample24(unsigned char *pSrc, signed char *pMCU, int lsize, int cx, int
     {
         for (x=0; x<cx; x++) // do 8x8 pixels
         {
-            cBlue = *pSrc++;
-            cGreen = *pSrc++;
-            cRed = *pSrc++;
+            cBlue = pSrc[iRed ^ 2];
+            cGreen = pSrc[1];
+            cRed = pSrc[iRed];
+            pSrc += 3;
             iY = (((cRed * 1225) + (cGreen * 2404) + (cBlue * 467)) >> 12) - 0x80;
             iCb = (cBlue << 11) + (cRed * -691) + (cGreen * -1357);
             iCr = (cRed << 11) + (cGreen * -1715) + (cBlue * -333);
@@ -1701,37 +2986,149 @@ void JPEGSample24(unsigned char *pSrc, signed char *pMCU, int lsize, int cx, int
     
 } /* JPEGSample24() */
 
-void JPEGGetMCU11(unsigned char *pImage, JPEGE_IMAGE *pPage, int iPitch)
+//
+// Copy a 8x8 block of packed 4:2:2 pixels without subsampling (4:4:4)
+// Each U/V pair is repeated for the two pixels which share it
+//
+void JPEGSampleYUV422(unsigned char *pSrc, signed char *pMCU, int lsize, int cx, int cy, uint8_t ucPixelType)
 {
-    int cx, cy;
-    signed char *pMCUData = pPage->MCUc;
-//    if (x*8 + 8 > pPage->iWidth)
-//        cx = pPage->iWidth & 7;
-//    else
-        cx = 8;
-//    if (y*8 + 8 > pPage->iHeight)
-//        cy = pPage->iHeight & 7;
-//    else
-        cy = 8;
-//    if (cy != 8 || cx != 8)
-//        memset(pMCUData, 0, 3*64*sizeof(short)); // make sure unused pixels are 0
-    if (pPage->ucPixelType == JPEGE_PIXEL_RGB888)
-        JPEGSample24(pImage, pMCUData, iPitch, cx, cy);
-    else if (pPage->ucPixelType == JPEGE_PIXEL_RGB565)
-        JPEGSample16(pImage, pMCUData, iPitch, cx, cy);
+    int x, y;
+    const uint8_t *pOffsets = ucYUVOffsets[ucPixelType - JPEGE_PIXEL_YUV422];
+
+    for (y=0; y<cy; y++)
+    {
+        for (x=0; x<cx; x++)
+        {
+            pMCU[64] = (signed char)(pSrc[(x>>1)*4 + pOffsets[1]] ^ 0x80);
+            pMCU[128] = (signed char)(pSrc[(x>>1)*4 + pOffsets[2]] ^ 0x80);
+            *pMCU++ = (signed char)(pSrc[(x>>1)*4 + (x&1)*2 + pOffsets[0]] ^ 0x80);
+        } // for x
+        pMCU += 8 - cx;
+        pSrc += lsize;
+    } // for y
+} /* JPEGSampleYUV422() */
+
+//
+// Sample one 8x8 block into Y/Cb/Cr at pMCU, pMCU+64 and pMCU+128
+//
+void JPEGSampleBlock(unsigned char *pImage, signed char *pMCU, int iPitch, uint8_t ucPixelType)
+{
+    if (ucPixelType == JPEGE_PIXEL_RGB888 || ucPixelType == JPEGE_PIXEL_BGR888)
+        JPEGSample24(pImage, pMCU, iPitch, 8, 8, (ucPixelType == JPEGE_PIXEL_BGR888) ? 0 : 2);
+    else if (ucPixelType == JPEGE_PIXEL_RGB565 || ucPixelType == JPEGE_PIXEL_RGB565_BE)
+        JPEGSample16(pImage, pMCU, iPitch, 8, 8, ucPixelType == JPEGE_PIXEL_RGB565_BE);
+    else if (JPEGE_IS_PACKED422(ucPixelType))
+        JPEGSampleYUV422(pImage, pMCU, iPitch, 8, 8, ucPixelType);
     else // must be 32-bpp
-        JPEGSample32(pImage, pMCUData, iPitch, cx, cy);
-    
-} /* JPEGGetMCU11() */
+        JPEGSample32(pImage, pMCU, iPitch, 8, 8, (ucPixelType == JPEGE_PIXEL_BGRA8888) ? 2 : 0);
+} /* JPEGSampleBlock() */
 
-void JPEGFDCT(signed char *pMCUSrc, signed short *pMCUDest)
+//
+// Sample only the Y of a 8x8 block of color pixels (luma-only output)
+// Uses the same math as the full samplers, minus the Cb/Cr work
+//
+void JPEGSampleLuma(unsigned char *pSrc, signed char *pMCU, int iPitch, uint8_t ucPixelType)
 {
-    int iCol;
-    int iRow;
-    signed int tmp0,tmp1,tmp2,tmp3,tmp4,tmp5,tmp6,tmp7,tmp10,tmp11,tmp12,tmp13;
-    signed int z1,z2,z3,z4,z5,z11,z13;
-    signed char *s = pMCUSrc;
-    signed short *d = pMCUDest;
+    int x, y, iRed;
+    unsigned short us;
+    const uint8_t *pOffsets;
+
+    for (y=0; y<8; y++) {
+        switch (ucPixelType) {
+            case JPEGE_PIXEL_RGB565:
+            case JPEGE_PIXEL_RGB565_BE:
+                for (x=0; x<8; x++) {
+                    us = (ucPixelType == JPEGE_PIXEL_RGB565) ? (pSrc[x*2] | (pSrc[x*2+1] << 8)) : ((pSrc[x*2] << 8) | pSrc[x*2+1]);
+                    pMCU[x] = (signed char)((((((us & 0xf800)>>8) | ((us & 0x3800)>>11)) * 1225 +
+                                              (((us & 0x7e0)>>3) | ((us & 0x60)>>5)) * 2404 +
+                                              (((us & 0x1f)<<3) | (us & 7)) * 467) >> 12) - 0x80);
+                }
+                break;
+            case JPEGE_PIXEL_RGB888: // B,G,R
+            case JPEGE_PIXEL_BGR888: // R,G,B
+                iRed = (ucPixelType == JPEGE_PIXEL_BGR888) ? 0 : 2;
+                for (x=0; x<8; x++) {
+                    pMCU[x] = (signed char)(((pSrc[x*3+iRed] * 1225 + pSrc[x*3+1] * 2404 + pSrc[x*3+(iRed ^ 2)] * 467) >> 12) - 0x80);
+                }
+                break;
+            case JPEGE_PIXEL_ARGB8888: // R,G,B,A
+            case JPEGE_PIXEL_BGRA8888: // B,G,R,A
+                iRed = (ucPixelType == JPEGE_PIXEL_BGRA8888) ? 2 : 0;
+                for (x=0; x<8; x++) {
+                    pMCU[x] = (signed char)(((pSrc[x*4+iRed] * 1225 + pSrc[x*4+1] * 2404 + pSrc[x*4+(iRed ^ 2)] * 467) >> 12) - 0x80);
+                }
+                break;
+            default: // packed YUV 4:2:2; just copy the Y samples
+                pOffsets = ucYUVOffsets[ucPixelType - JPEGE_PIXEL_YUV422];
+                for (x=0; x<8; x++) {
+                    pMCU[x] = (signed char)(pSrc[(x>>1)*4 + (x&1)*2 + pOffsets[0]] ^ 0x80);
+                }
+                break;
+        }
+        pMCU += 8;
+        pSrc += iPitch;
+    } // for y
+} /* JPEGSampleLuma() */
+
+void JPEGGetMCU11(unsigned char *pImage, JPEGE_IMAGE *pPage, int iPitch, uint8_t ucPixelType)
+{
+    // partial edge MCUs have already been padded to full size by JPEGPadMCU()
+    JPEGSampleBlock(pImage, pPage->MCUc, iPitch, ucPixelType);
+} /* JPEGGetMCU11() */
+
+//
+// Sample a 16x8 MCU for 4:2:2 output (Y0, Y1 in blocks 0/1, Cb/Cr in 4/5)
+// packed YUV pixels already have their chroma at this resolution, so they're just
+// copied; other types are sampled at full size and the chroma of each
+// horizontal pair of pixels is averaged
+//
+void JPEGGetMCU21(unsigned char *pImage, JPEGE_IMAGE *pPage, int iPitch, uint8_t ucPixelType)
+{
+    int x, y;
+    signed char *pMCUData = pPage->MCUc;
+    signed char *pY, *pCb, *pCr, *s;
+    signed char *pTemp = pPage->cSampleTemp; // full resolution Y/Cb/Cr of the left and right halves
+    uint8_t *p;
+
+    // partial edge MCUs have already been padded to full size by JPEGPadMCU()
+    pY = pMCUData;
+    pCb = &pMCUData[DCTSIZE*4];
+    pCr = &pMCUData[DCTSIZE*5];
+    if (JPEGE_IS_PACKED422(ucPixelType)) { // Y0 U Y1 V (or similar)
+        const uint8_t *pOffsets = ucYUVOffsets[ucPixelType - JPEGE_PIXEL_YUV422];
+        for (y=0; y<8; y++) {
+            p = &pImage[y * iPitch];
+            for (x=0; x<8; x++) { // each U/V pair covers two Y values
+                pY[x] = (signed char)(p[x*2 + pOffsets[0]] ^ 0x80); // left
+                pY[DCTSIZE + x] = (signed char)(p[16 + x*2 + pOffsets[0]] ^ 0x80); // right
+                pCb[x] = (signed char)(p[x*4 + pOffsets[1]] ^ 0x80);
+                pCr[x] = (signed char)(p[x*4 + pOffsets[2]] ^ 0x80);
+            }
+            pY += 8; pCb += 8; pCr += 8;
+        }
+        return;
+    }
+    JPEGSampleBlock(pImage, pTemp, iPitch, ucPixelType); // left
+    JPEGSampleBlock(pImage + 8*ucPixelBytes[ucPixelType], &pTemp[DCTSIZE*3], iPitch, ucPixelType); // right
+    memcpy(pY, pTemp, DCTSIZE);
+    memcpy(&pY[DCTSIZE], &pTemp[DCTSIZE*3], DCTSIZE);
+    for (y=0; y<8; y++) {
+        for (x=0; x<8; x++) {
+            s = &pTemp[(x>>2)*DCTSIZE*3 + y*8 + (x&3)*2];
+            *pCb++ = (signed char)((s[DCTSIZE] + s[DCTSIZE+1] + 1) >> 1);
+            *pCr++ = (signed char)((s[DCTSIZE*2] + s[DCTSIZE*2+1] + 1) >> 1);
+        }
+    }
+} /* JPEGGetMCU21() */
+
+void JPEGFDCT(signed char *pMCUSrc, signed short *pMCUDest)
+{
+    int iCol;
+    int iRow;
+    signed int tmp0,tmp1,tmp2,tmp3,tmp4,tmp5,tmp6,tmp7,tmp10,tmp11,tmp12,tmp13;
+    signed int z1,z2,z3,z4,z5,z11,z13;
+    signed char *s = pMCUSrc;
+    signed short *d = pMCUDest;
     // do rows first
     for (iRow=0; iRow<64; iRow+=8, s += 8, d += 8)
     {
@@ -1823,132 +3220,1159 @@ void FlushCode(PIL_CODE *pPC)
     pPC->iLen = 0;
 } /* FlushCode() */
 
-int JPEGAddMCU(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch)
+//
+// Prepare a partial MCU on the right or bottom edge of the image
+// Only the valid source pixels are read; they're copied into a temporary
+// MCU-sized buffer and the last column and row are replicated to fill it.
+// This keeps the samplers from reading past the edges of the caller's image
+// and the replicated pixels compress better than garbage or black.
+// Returns the new source pointer and updates the pitch to match.
+//
+uint8_t * JPEGPadMCU(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pSrc, int *piPitch, uint8_t *pDest)
 {
-    int bSparse;
+    int x, y, cx, cy, iBpp, iCount, iDestPitch;
+    uint8_t *d;
+
+    cx = pJPEG->iWidth - pEncode->x;
+    if (cx > pEncode->cx) cx = pEncode->cx;
+    cy = pJPEG->iHeight - pEncode->y;
+    if (cy > pEncode->cy) cy = pEncode->cy;
+    iBpp = ucPixelBytes[pJPEG->ucPixelType];
+    iDestPitch = pEncode->cx * iBpp;
+    if (JPEGE_IS_PACKED422(pJPEG->ucPixelType)) {
+        // pixels come in pairs which share U/V, so work in 4-byte units
+        iBpp = 4;
+        cx = (cx + 1) >> 1;
+    }
+    iCount = cx * iBpp; // valid bytes per line
+    d = pDest;
+    for (y=0; y<pEncode->cy; y++) {
+        if (y < cy) {
+            memcpy(d, pSrc, iCount);
+            for (x=iCount; x<iDestPitch; x += iBpp) { // replicate the last pixel
+                memcpy(&d[x], &d[iCount - iBpp], iBpp);
+            }
+            pSrc += *piPitch;
+        } else { // replicate the last line
+            memcpy(d, d - iDestPitch, iDestPitch);
+        }
+        d += iDestPitch;
+    } // for y
+    *piPitch = iDestPitch;
+    return pDest;
+} /* JPEGPadMCU() */
+
+//
+// Copy the current MCU from a planar YUV 4:2:0 source (I420, NV12 or NV21)
+// The samples are already Y/Cb/Cr, so there is no color math at all; like
+// JPEGGetMCU(), the only work is flipping the top bit to make them signed.
+// Chroma is replicated for 4:4:4 output and pixels beyond the right/bottom
+// edges repeat the last valid ones.
+//
+void JPEGGetMCUPlanar(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch)
+{
+    int x, y, b, cx, cy, sx, sy, i, iBlocks, iCPitch, iStep, iSub;
+    uint8_t *s, *pU, *pV;
+    uint32_t *pDest;
+    signed char *d;
+
+    cx = pJPEG->iWidth - pEncode->x;
+    if (cx > pEncode->cx) cx = pEncode->cx;
+    cy = pJPEG->iHeight - pEncode->y;
+    if (cy > pEncode->cy) cy = pEncode->cy;
+    pU = &pPixels[iPitch * pJPEG->iHeight]; // chroma follows the Y plane
+    if (pJPEG->ucPixelType == JPEGE_PIXEL_I420) {
+        iCPitch = (iPitch + 1) >> 1;
+        pV = &pU[iCPitch * ((pJPEG->iHeight + 1) >> 1)];
+        iStep = 1;
+    } else { // interleaved chroma
+        iCPitch = iPitch;
+        iStep = 2;
+        pV = pU + 1;
+        if (pJPEG->ucPixelType == JPEGE_PIXEL_NV21) { // V comes first
+            pV = pU;
+            pU++;
+        }
+    }
+    pPixels += pEncode->y * iPitch + pEncode->x;
+    iBlocks = (pEncode->cx >> 3) * (pEncode->cy >> 3);
+    for (b=0; b<iBlocks; b++) { // Y
+        d = &pJPEG->MCUc[b * DCTSIZE];
+        for (y=0; y<8; y++) {
+            sy = (b >> 1)*8 + y;
+            s = &pPixels[((sy < cy) ? sy : cy-1) * iPitch + (b & 1)*8];
+            if ((b & 1)*8 + 8 <= cx) { // the whole line is inside the image
+                pDest = (uint32_t *)d;
+                pDest[0] = (s[0] | (s[1] << 8) | (s[2] << 16) | ((uint32_t)s[3] << 24)) ^ 0x80808080;
+                pDest[1] = (s[4] | (s[5] << 8) | (s[6] << 16) | ((uint32_t)s[7] << 24)) ^ 0x80808080;
+            } else {
+                for (x=0; x<8; x++) {
+                    sx = (b & 1)*8 + x;
+                    d[x] = (signed char)(s[((sx < cx) ? sx : cx-1) - (b & 1)*8] ^ 0x80);
+                }
+            }
+            d += 8;
+        }
+    } // for b
+    if (pJPEG->ucNumComponents == 1) // luma only
+        return;
+    // Cb/Cr: each chroma sample covers 2x2 pixels of the source
+    iSub = pEncode->cx >> 3; // horizontal pixels per chroma block sample
+    d = &pJPEG->MCUc[((pEncode->cx == 16) ? 4 : 1) * DCTSIZE];
+    for (y=0; y<8; y++) {
+        sy = y * (pEncode->cy >> 3);
+        if (sy >= cy) sy = cy-1;
+        sy = ((pEncode->y + sy) >> 1) * iCPitch;
+        for (x=0; x<8; x++) {
+            sx = x * iSub;
+            if (sx >= cx) sx = cx-1;
+            i = sy + ((pEncode->x + sx) >> 1) * iStep;
+            d[DCTSIZE] = (signed char)(pV[i] ^ 0x80);
+            *d++ = (signed char)(pU[i] ^ 0x80);
+        }
+    }
+} /* JPEGGetMCUPlanar() */
+
+//
+// Read one raw sample of a Bayer source; 16-bit samples are scaled to 8 bits
+//
+int JPEGBayerSample(JPEGE_IMAGE *pJPEG, uint8_t *pPixels, int iPitch, int x, int y)
+{
+    if (pJPEG->ucPixelType < JPEGE_PIXEL_BAYER16_RGGB)
+        return pPixels[y * iPitch + x];
+    pPixels += y * iPitch + x * 2;
+    return JPEGToneMap(pJPEG, pPixels[0] | (pPixels[1] << 8));
+} /* JPEGBayerSample() */
+
+//
+// Convert a MCU of 16-bit gray or RGB48 pixels to 8-bit gray or B,G,R
+// for the samplers
+//
+void JPEGConvert16(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pSrc, int iPitch, uint8_t *pDest)
+{
+    int x, y, iCount;
+
+    iCount = pEncode->cx * ((pJPEG->ucPixelType == JPEGE_PIXEL_GRAY16) ? 1 : 3); // samples per line
+    for (y=0; y<pEncode->cy; y++) {
+        if (pJPEG->ucPixelType == JPEGE_PIXEL_GRAY16) {
+            for (x=0; x<iCount; x++) {
+                pDest[x] = (uint8_t)JPEGToneMap(pJPEG, pSrc[x*2] | (pSrc[x*2+1] << 8));
+            }
+        } else { // R,G,B -> B,G,R
+            for (x=0; x<iCount; x+=3) {
+                pDest[x] = (uint8_t)JPEGToneMap(pJPEG, pSrc[x*2+4] | (pSrc[x*2+5] << 8));
+                pDest[x+1] = (uint8_t)JPEGToneMap(pJPEG, pSrc[x*2+2] | (pSrc[x*2+3] << 8));
+                pDest[x+2] = (uint8_t)JPEGToneMap(pJPEG, pSrc[x*2] | (pSrc[x*2+1] << 8));
+            }
+        }
+        pSrc += iPitch;
+        pDest += iCount;
+    }
+} /* JPEGConvert16() */
+
+//
+// Demosaic the current MCU of a Bayer source into a B,G,R tile with
+// bilinear interpolation. The neighbors of the first/last lines and columns
+// are mirrored (which keeps the color of each site) and pixels beyond the
+// right/bottom edges repeat the last valid ones.
+//
+void JPEGDemosaicMCU(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch, uint8_t *pDest)
+{
+    int x, y, i, j, cx, cy, sx, sy, iColor, iH, c[3], n[9], xx[3], yy[3];
+    const uint8_t *pColors = ucBayerColors[(pJPEG->ucPixelType - JPEGE_PIXEL_BAYER_RGGB) & 3];
+
+    cx = pJPEG->iWidth - pEncode->x;
+    if (cx > pEncode->cx) cx = pEncode->cx;
+    cy = pJPEG->iHeight - pEncode->y;
+    if (cy > pEncode->cy) cy = pEncode->cy;
+    for (y=0; y<pEncode->cy; y++) {
+        sy = pEncode->y + ((y < cy) ? y : cy-1);
+        for (i=0; i<3; i++) {
+            yy[i] = sy + i - 1;
+            if (yy[i] < 0) yy[i] = 1;
+            if (yy[i] >= pJPEG->iHeight) yy[i] = pJPEG->iHeight - 2;
+            if (yy[i] < 0) yy[i] = 0; // only one line
+        }
+        for (x=0; x<pEncode->cx; x++) {
+            sx = pEncode->x + ((x < cx) ? x : cx-1);
+            for (i=0; i<3; i++) {
+                xx[i] = sx + i - 1;
+                if (xx[i] < 0) xx[i] = 1;
+                if (xx[i] >= pJPEG->iWidth) xx[i] = pJPEG->iWidth - 2;
+                if (xx[i] < 0) xx[i] = 0; // only one column
+            }
+            for (j=0; j<3; j++) { // 3x3 neighborhood
+                for (i=0; i<3; i++) {
+                    n[j*3+i] = JPEGBayerSample(pJPEG, pPixels, iPitch, xx[i], yy[j]);
+                }
+            }
+            iColor = pColors[((sy & 1) << 1) + (sx & 1)];
+            c[iColor] = n[4];
+            if (iColor == 1) { // green site; red/blue are on the left/right or above/below
+                iH = pColors[((sy & 1) << 1) + ((sx & 1) ^ 1)];
+                c[iH] = (n[3] + n[5] + 1) >> 1;
+                c[2-iH] = (n[1] + n[7] + 1) >> 1;
+            } else { // red or blue site
+                c[1] = (n[1] + n[3] + n[5] + n[7] + 2) >> 2;
+                c[2-iColor] = (n[0] + n[2] + n[6] + n[8] + 2) >> 2;
+            }
+            *pDest++ = (uint8_t)c[2]; // B
+            *pDest++ = (uint8_t)c[1]; // G
+            *pDest++ = (uint8_t)c[0]; // R
+        } // for x
+    } // for y
+} /* JPEGDemosaicMCU() */
+
+//
+// Gather the source pixels of the current MCU when the image is being
+// rotated or mirrored. The pixels are copied into a small MCU-sized buffer
+// in the order the samplers expect, so no rotated copy of the whole image
+// is needed. Pixels beyond the right/bottom edges are replicated.
+//
+void JPEGGatherMCU(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch, uint8_t *pDest)
+{
+    int x, y, cx, cy, iBpp, iColStep, iRowStep, iDestPitch;
+    const signed char *pXForm = cOrientXForm[pJPEG->ucOrientation];
+    uint8_t *s, *d;
+
+    cx = pJPEG->iWidth - pEncode->x;
+    if (cx > pEncode->cx) cx = pEncode->cx;
+    cy = pJPEG->iHeight - pEncode->y;
+    if (cy > pEncode->cy) cy = pEncode->cy;
+    iDestPitch = pEncode->cx * ucPixelBytes[pJPEG->ucPixelType];
+    if (JPEGE_IS_PACKED422(pJPEG->ucPixelType)) {
+        // pixel pairs share U/V, so each output pair gets the Y of the two source
+        // pixels it comes from and the average of their U/V values
+        int u, v, sx[2], sy[2], i, iU, iV;
+        uint8_t *p;
+        const uint8_t *pOffsets = ucYUVOffsets[pJPEG->ucPixelType - JPEGE_PIXEL_YUV422];
+        for (y=0; y<pEncode->cy; y++) {
+            d = &pDest[y * iDestPitch];
+            v = pEncode->y + ((y < cy) ? y : cy-1);
+            for (x=0; x<pEncode->cx; x+=2) {
+                iU = iV = 1; // rounding
+                for (i=0; i<2; i++) {
+                    u = pEncode->x + ((x+i < cx) ? x+i : cx-1);
+                    sx[i] = u*pXForm[0] + v*pXForm[1] + (pXForm[4] ? pJPEG->iSrcWidth-1 : 0) + pJPEG->ucPairOffset;
+                    sy[i] = u*pXForm[2] + v*pXForm[3] + (pXForm[5] ? pJPEG->iSrcHeight-1 : 0);
+                    p = &pPixels[sy[i] * iPitch + (sx[i] >> 1) * 4];
+                    d[i*2 + pOffsets[0]] = p[(sx[i] & 1) * 2 + pOffsets[0]];
+                    iU += p[pOffsets[1]];
+                    iV += p[pOffsets[2]];
+                }
+                d[pOffsets[1]] = (uint8_t)(iU >> 1);
+                d[pOffsets[2]] = (uint8_t)(iV >> 1);
+                d += 4;
+            } // for x
+        } // for y
+        return;
+    }
+    iBpp = ucPixelBytes[pJPEG->ucPixelType];
+    // step through the source in the rotated directions
+    iColStep = pXForm[0]*iBpp + pXForm[2]*iPitch;
+    iRowStep = pXForm[1]*iBpp + pXForm[3]*iPitch;
+    if (pXForm[4]) pPixels += (pJPEG->iSrcWidth - 1) * iBpp;
+    if (pXForm[5]) pPixels += (pJPEG->iSrcHeight - 1) * iPitch;
+    pPixels += pEncode->x * iColStep;
+    for (y=0; y<pEncode->cy; y++) {
+        d = &pDest[y * iDestPitch];
+        s = pPixels + (pEncode->y + ((y < cy) ? y : cy-1)) * iRowStep;
+        switch (iBpp) {
+            case 1:
+                for (x=0; x<cx; x++) {
+                    d[x] = *s;
+                    s += iColStep;
+                }
+                break;
+            case 2:
+                for (x=0; x<cx; x++) {
+                    *(uint16_t *)&d[x*2] = *(uint16_t *)s;
+                    s += iColStep;
+                }
+                break;
+            case 3:
+                for (x=0; x<cx; x++) {
+                    d[x*3] = s[0]; d[x*3+1] = s[1]; d[x*3+2] = s[2];
+                    s += iColStep;
+                }
+                break;
+            case 4:
+                for (x=0; x<cx; x++) {
+                    *(uint32_t *)&d[x*4] = *(uint32_t *)s;
+                    s += iColStep;
+                }
+                break;
+            default: // 16-bit RGB
+                for (x=0; x<cx; x++) {
+                    memcpy(&d[x*iBpp], s, iBpp);
+                    s += iColStep;
+                }
+                break;
+        }
+        for (x=cx*iBpp; x<iDestPitch; x += iBpp) { // replicate the last pixel
+            memcpy(&d[x], &d[(cx-1)*iBpp], iBpp);
+        }
+    } // for y
+} /* JPEGGatherMCU() */
+
+//
+// Gather the current MCU from a downscaled view of the source image
+// Each output pixel is the average (box filter) of a 2x2, 4x4 or 8x8 block
+// of source pixels (fewer on the right/bottom edges). Orientation is applied
+// to the block coordinates, so both can be combined. The averages are stored
+// as RGB888 (grayscale keeps its own format and packed YUV becomes YUYV) and
+// the tile's pixel type is returned for the samplers.
+//
+uint8_t JPEGGatherScaledMCU(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch, uint8_t *pDest)
+{
+    int x, y, u, v, sx, sy, x0, x1, y0, y1, cx, cy, iCount, iShift;
+    int iSrcW, iSrcH, iDestPitch, iPairCount = 0;
+    int i0, i1, i2, iU = 0, iV = 0;
+    uint16_t us;
+    uint8_t *s, *d, ucType;
+    const signed char *pXForm = cOrientXForm[pJPEG->ucOrientation];
+    const uint8_t *pOffsets = ucYUVOffsets[0];
+
+    iShift = pJPEG->ucScale;
+    iSrcW = (pJPEG->iSrcWidth + (1 << iShift) - 1) >> iShift; // size of the scaled source
+    iSrcH = (pJPEG->iSrcHeight + (1 << iShift) - 1) >> iShift;
+    cx = pJPEG->iWidth - pEncode->x;
+    if (cx > pEncode->cx) cx = pEncode->cx;
+    cy = pJPEG->iHeight - pEncode->y;
+    if (cy > pEncode->cy) cy = pEncode->cy;
+    ucType = pJPEG->ucPixelType;
+    if (ucType == JPEGE_PIXEL_GRAY16 || pJPEG->ucAlphaPlane)
+        ucType = JPEGE_PIXEL_GRAYSCALE;
+    else if (ucType != JPEGE_PIXEL_GRAYSCALE && !JPEGE_IS_PACKED422(ucType)) // all RGB types
+        ucType = JPEGE_PIXEL_RGB888;
+    if (JPEGE_IS_PACKED422(ucType)) {
+        pOffsets = ucYUVOffsets[ucType - JPEGE_PIXEL_YUV422];
+        ucType = JPEGE_PIXEL_YUV422;
+    }
+    iDestPitch = pEncode->cx * ucPixelBytes[ucType];
+    for (y=0; y<pEncode->cy; y++) {
+        d = &pDest[y * iDestPitch];
+        v = pEncode->y + ((y < cy) ? y : cy-1);
+        for (x=0; x<pEncode->cx; x++) {
+            u = pEncode->x + ((x < cx) ? x : cx-1);
+            sx = u*pXForm[0] + v*pXForm[1] + (pXForm[4] ? iSrcW-1 : 0);
+            sy = u*pXForm[2] + v*pXForm[3] + (pXForm[5] ? iSrcH-1 : 0);
+            x0 = sx << iShift; x1 = x0 + (1 << iShift);
+            if (x1 > pJPEG->iSrcWidth) x1 = pJPEG->iSrcWidth;
+            y0 = sy << iShift; y1 = y0 + (1 << iShift);
+            if (y1 > pJPEG->iSrcHeight) y1 = pJPEG->iSrcHeight;
+            iCount = (x1 - x0) * (y1 - y0);
+            i0 = i1 = i2 = 0;
+            for (sy = y0; sy < y1; sy++) {
+                s = &pPixels[sy * iPitch];
+                if (pJPEG->ucAlphaPlane) { // only the alpha of the 32-bit pixels
+                    for (sx = x0; sx < x1; sx++)
+                        i0 += s[sx*4+3];
+                    continue;
+                }
+                switch (pJPEG->ucPixelType) {
+                    case JPEGE_PIXEL_GRAYSCALE:
+                        for (sx = x0; sx < x1; sx++)
+                            i0 += s[sx];
+                        break;
+                    case JPEGE_PIXEL_GRAY16:
+                        for (sx = x0; sx < x1; sx++)
+                            i0 += s[sx*2] | (s[sx*2+1] << 8);
+                        break;
+                    case JPEGE_PIXEL_RGB48: // R,G,B
+                        for (sx = x0; sx < x1; sx++) {
+                            i0 += s[sx*6+4] | (s[sx*6+5] << 8);
+                            i1 += s[sx*6+2] | (s[sx*6+3] << 8);
+                            i2 += s[sx*6] | (s[sx*6+1] << 8);
+                        }
+                        break;
+                    case JPEGE_PIXEL_RGB565:
+                    case JPEGE_PIXEL_RGB565_BE:
+                        for (sx = x0; sx < x1; sx++) {
+                            us = (pJPEG->ucPixelType == JPEGE_PIXEL_RGB565) ? (s[sx*2] | (s[sx*2+1] << 8)) : ((s[sx*2] << 8) | s[sx*2+1]);
+                            i0 += ((us & 0x1f)<<3) | (us & 7); // B
+                            i1 += ((us & 0x7e0)>>3) | ((us & 0x60)>>5); // G
+                            i2 += ((us & 0xf800)>>8) | ((us & 0x3800)>>11); // R
+                        }
+                        break;
+                    case JPEGE_PIXEL_RGB888:
+                        for (sx = x0; sx < x1; sx++) {
+                            i0 += s[sx*3]; i1 += s[sx*3+1]; i2 += s[sx*3+2];
+                        }
+                        break;
+                    case JPEGE_PIXEL_BGR888: // stored as R,G,B
+                        for (sx = x0; sx < x1; sx++) {
+                            i0 += s[sx*3+2]; i1 += s[sx*3+1]; i2 += s[sx*3];
+                        }
+                        break;
+                    case JPEGE_PIXEL_ARGB8888: // stored as R,G,B,A
+                        for (sx = x0; sx < x1; sx++) {
+                            i0 += s[sx*4+2]; i1 += s[sx*4+1]; i2 += s[sx*4];
+                        }
+                        break;
+                    case JPEGE_PIXEL_BGRA8888: // stored as B,G,R,A
+                        for (sx = x0; sx < x1; sx++) {
+                            i0 += s[sx*4]; i1 += s[sx*4+1]; i2 += s[sx*4+2];
+                        }
+                        break;
+                    default: // packed YUV 4:2:2
+                        for (sx = x0 + pJPEG->ucPairOffset; sx < x1 + pJPEG->ucPairOffset; sx++) {
+                            i0 += s[(sx >> 1)*4 + (sx & 1)*2 + pOffsets[0]];
+                            i1 += s[(sx >> 1)*4 + pOffsets[1]];
+                            i2 += s[(sx >> 1)*4 + pOffsets[2]];
+                        }
+                        break;
+                }
+            } // for sy
+            if (ucType == JPEGE_PIXEL_YUV422) { // U/V are shared by each output pair
+                d[(x & 1)*2] = (uint8_t)((i0 + (iCount >> 1)) / iCount);
+                iU += i1; iV += i2; iPairCount += iCount;
+                if (x & 1) {
+                    d[1] = (uint8_t)((iU + (iPairCount >> 1)) / iPairCount);
+                    d[3] = (uint8_t)((iV + (iPairCount >> 1)) / iPairCount);
+                    iU = iV = iPairCount = 0;
+                    d += 4;
+                }
+            } else if (pJPEG->ucPixelType == JPEGE_PIXEL_GRAY16 || pJPEG->ucPixelType == JPEGE_PIXEL_RGB48) {
+                *d++ = (uint8_t)JPEGToneMap(pJPEG, (i0 + (iCount >> 1)) / iCount);
+                if (ucType == JPEGE_PIXEL_RGB888) {
+                    *d++ = (uint8_t)JPEGToneMap(pJPEG, (i1 + (iCount >> 1)) / iCount);
+                    *d++ = (uint8_t)JPEGToneMap(pJPEG, (i2 + (iCount >> 1)) / iCount);
+                }
+            } else {
+                *d++ = (uint8_t)((i0 + (iCount >> 1)) / iCount);
+                if (ucType == JPEGE_PIXEL_RGB888) {
+                    *d++ = (uint8_t)((i1 + (iCount >> 1)) / iCount);
+                    *d++ = (uint8_t)((i2 + (iCount >> 1)) / iCount);
+                }
+            }
+        } // for x
+    } // for y
+    return ucType;
+} /* JPEGGatherScaledMCU() */
+
+//
+// Add the block averages (DC values) of the current MCU to the thumbnail row
+//
+void JPEGThumbAddMCU(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode)
+{
+    int b, x, y, iCb, iCr;
+    uint16_t *p;
+
+    x = pEncode->x >> 3;
+    y = pEncode->y >> 3;
+    if (pJPEG->ucNumComponents == 1) {
+        iCb = iCr = 128;
+    } else { // the same chroma for all Y blocks of a 4:2:0/4:2:2 MCU
+        iCb = ((pJPEG->sDC[(pEncode->cx == 16) ? 4 : 1] + 32) >> 6) + 128;
+        iCr = ((pJPEG->sDC[(pEncode->cx == 16) ? 5 : 2] + 32) >> 6) + 128;
+    }
+    for (b=0; b<(pEncode->cx >> 3) * (pEncode->cy >> 3); b++) {
+        if (((x + (b & 1)) << 3) >= pJPEG->iWidth || ((y + (b >> 1)) << 3) >= pJPEG->iHeight)
+            continue; // padding block beyond the image edge
+        p = &pJPEG->pThumbAcc[((x + (b & 1)) >> pJPEG->ucThumbShift) * 3];
+        p[0] += ((pJPEG->sDC[b] + 32) >> 6) + 128;
+        p[1] += iCb;
+        p[2] += iCr;
+    }
+} /* JPEGThumbAddMCU() */
+
+//
+// Convert a completed row of thumbnail averages to RGB and store it in the
+// space reserved in the APP0 header
+//
+void JPEGThumbRow(JPEGE_IMAGE *pJPEG, int iRow)
+{
+    int x, iCount, iCountX, iCountY, iBlocksW, iBlocksH, iY, iCb, iCr, r, g, b;
+    uint16_t *p = pJPEG->pThumbAcc;
+    uint8_t *pRow = (uint8_t *)&p[pJPEG->ucThumbMax * 3]; // follows the sums in the work area
+
+    iBlocksW = (pJPEG->iWidth + 7) >> 3;
+    iBlocksH = (pJPEG->iHeight + 7) >> 3;
+    iCountY = iBlocksH - (iRow << pJPEG->ucThumbShift); // blocks in the last row/column can be fewer
+    if (iCountY > (1 << pJPEG->ucThumbShift)) iCountY = 1 << pJPEG->ucThumbShift;
+    for (x=0; x<pJPEG->ucThumbWidth; x++) {
+        iCountX = iBlocksW - (x << pJPEG->ucThumbShift);
+        if (iCountX > (1 << pJPEG->ucThumbShift)) iCountX = 1 << pJPEG->ucThumbShift;
+        iCount = iCountX * iCountY;
+        iY = (p[0] + (iCount >> 1)) / iCount;
+        iCb = (p[1] + (iCount >> 1)) / iCount - 128;
+        iCr = (p[2] + (iCount >> 1)) / iCount - 128;
+        r = iY + ((iCr * 359) >> 8);
+        g = iY - ((iCb * 88 + iCr * 183) >> 8);
+        b = iY + ((iCb * 454) >> 8);
+        pRow[x*3] = (uint8_t)((r < 0) ? 0 : (r > 255) ? 255 : r);
+        pRow[x*3+1] = (uint8_t)((g < 0) ? 0 : (g > 255) ? 255 : g);
+        pRow[x*3+2] = (uint8_t)((b < 0) ? 0 : (b > 255) ? 255 : b);
+        p[0] = p[1] = p[2] = 0; // ready for the next row
+        p += 3;
+    }
+    iCount = pJPEG->ucThumbWidth * 3;
+    if (pJPEG->pOutput) {
+        memcpy(&pJPEG->pOutput[JPEGE_THUMB_OFFSET + iRow * iCount], pRow, iCount);
+    } else { // already written to the file; go back and replace it
+        pJPEG->pfnSeek(&pJPEG->JPEGFile, JPEGE_THUMB_OFFSET + iRow * iCount);
+        pJPEG->pfnWrite(&pJPEG->JPEGFile, pRow, iCount);
+        pJPEG->pfnSeek(&pJPEG->JPEGFile, pJPEG->iDataSize);
+    }
+} /* JPEGThumbRow() */
+//
+// Transform and quantize the current MCU into the coefficient planes
+// of a progressive image (see JPEGEncodeProgressive)
+//
+void JPEGProgStoreMCU(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode)
+{
+    int b, c, iBlock, iH, iV, x, y;
+    signed short *pDest;
+
+    iH = JPEGProgH(pJPEG, 0);
+    iV = JPEGProgV(pJPEG, 0);
+    x = pEncode->x / pEncode->cx; // MCU position
+    y = pEncode->y / pEncode->cy;
+    for (b=0; b<iH*iV + ((pJPEG->ucNumComponents == 3) ? 2 : 0); b++) {
+        if (b < iH*iV) { // Y blocks are in raster order within the MCU
+            c = 0;
+            iBlock = b;
+            pDest = &pJPEG->pProgCoeffs[0][((y*iV + (b / iH)) * pJPEG->iMCUWidth * iH + x*iH + (b % iH)) * DCTSIZE];
+        } else { // Cb/Cr are blocks 4 and 5 of a 16 pixel wide MCU
+            c = b - iH*iV + 1;
+            iBlock = (pEncode->cx == 16) ? c + 3 : c;
+            pDest = &pJPEG->pProgCoeffs[c][(y * pJPEG->iMCUWidth + x) * DCTSIZE];
+        }
+        JPEGFDCT(&pJPEG->MCUc[iBlock*DCTSIZE], pJPEG->MCUs);
+        pJPEG->sDC[iBlock] = pJPEG->MCUs[0];
+        JPEGQuantize(pJPEG, pJPEG->MCUs, (c) ? 1 : 0);
+        memcpy(pDest, pJPEG->MCUs, DCTSIZE * sizeof(signed short));
+    }
+} /* JPEGProgStoreMCU() */
+
+//
+// Finish a segment: write out the last bits and remove the stuffed 0 bytes
+// so that the segments can be joined at any bit position
+//
+void JPEGSegmentEnd(JPEGE_IMAGE *pJPEG)
+{
+    JPEGE_SEGMENT *pSeg = pJPEG->pSegment;
+    uint8_t *s, *d, *pEnd = pJPEG->pc.pOut;
+    int iBytes = -1, iPending = (int)pJPEG->pc.iLen;
+
+    FlushCode(&pJPEG->pc);
+    for (s = d = pJPEG->pOutput; s < pJPEG->pc.pOut; s++) {
+        if (s == pEnd) iBytes = (int)(d - pJPEG->pOutput); // whole bytes before the flush
+        *d++ = *s;
+        if (*s == 0xff) s++; // skip the stuffed 0
+    }
+    if (iBytes < 0) iBytes = (int)(d - pJPEG->pOutput);
+    pSeg->pData = pJPEG->pOutput;
+    pSeg->iBits = iBytes * 8 + iPending;
+    pSeg->iLastDC[0] = pJPEG->iDCPred0;
+    pSeg->iLastDC[1] = pJPEG->iDCPred1;
+    pSeg->iLastDC[2] = pJPEG->iDCPred2;
+    pJPEG->pc.pOut = d;
+    pJPEG->iDataSize = (int)(d - pJPEG->pOutput);
+} /* JPEGSegmentEnd() */
+
+//
+// Transform, quantize and encode the samples in MCUc and advance to the next MCU
+// The DC value of each block is kept in sDC[] (see JPEGAddFramePyramid)
+//
+int JPEGEncodeSamples(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode)
+{
+    int bSparse, iLevel;
     
-    if (pEncode->y >= pJPEG->iHeight) {
-        // the image is already complete or was not initialized properly
+    if (pJPEG->pSegment && pJPEG->iSegmentLeft == 0) { // the segment is complete
         pJPEG->iError = JPEGE_INVALID_PARAMETER;
         return JPEGE_INVALID_PARAMETER;
     }
-    if (pJPEG->ucPixelType == JPEGE_PIXEL_GRAYSCALE) {
-        JPEGGetMCU(pPixels, iPitch, pJPEG->MCUc);
+    if (pJPEG->pROIMap) { // look up the importance of this MCU
+        iLevel = pJPEG->pROIMap[(pEncode->y / pEncode->cy) * pJPEG->iROIPitch + (pEncode->x / pEncode->cx)];
+        pJPEG->ucROIKeep = (uint8_t)(1 + ((iLevel * (DCTSIZE-1) + 127) / 255));
+        pJPEG->ucROIDeadZone = (uint8_t)(((255 - iLevel) * 8 + 127) / 255);
+    }
+    if (pJPEG->pProgArena) { // progressive; the scans are written at the end
+        JPEGProgStoreMCU(pJPEG, pEncode);
+    } else if (pJPEG->ucNumComponents == 1) { // grayscale
         JPEGFDCT(pJPEG->MCUc, pJPEG->MCUs);
+        pJPEG->sDC[0] = pJPEG->MCUs[0];
         bSparse = JPEGQuantize(pJPEG, pJPEG->MCUs, 0);
         pJPEG->iDCPred0 = JPEGEncodeMCU(0, pJPEG, pJPEG->MCUs, pJPEG->iDCPred0, bSparse);
-        if (pEncode->x >= (pJPEG->iWidth - pEncode->cx)) { // end of the row?
-            // Store the restart marker
-            FlushCode(&pJPEG->pc);
-            *(pJPEG->pc.pOut)++ = 0xff; // store restart marker
-            *(pJPEG->pc.pOut)++ = (unsigned char) (0xd0 + (pJPEG->iRestart & 7));
-            pJPEG->iRestart++;
-            pJPEG->iDCPred0 = 0; // reset the DC predictor
-            pEncode->x = 0;
-            pEncode->y += pEncode->cy;
-            if (pEncode->y >= pJPEG->iHeight && pJPEG->pOutput != NULL) {
-                pJPEG->iDataSize = (int)(pJPEG->pc.pOut - pJPEG->pOutput);
-            }
-        } else {
-            pEncode->x += pEncode->cx;
-        } // grayscale
-    } else { // color
-        if (pJPEG->ucSubSample == JPEGE_SUBSAMPLE_444) {
-            JPEGGetMCU11(pPixels, pJPEG, iPitch);
-            JPEGFDCT(&pJPEG->MCUc[0*DCTSIZE], pJPEG->MCUs);
-            // Y
-            bSparse = JPEGQuantize(pJPEG, pJPEG->MCUs, 0);
-            pJPEG->iDCPred0 = JPEGEncodeMCU(0, pJPEG, pJPEG->MCUs, pJPEG->iDCPred0, bSparse);
-            JPEGFDCT(&pJPEG->MCUc[1*DCTSIZE], pJPEG->MCUs);
-            // Cb
-            bSparse = JPEGQuantize(pJPEG, pJPEG->MCUs, 1);
-            pJPEG->iDCPred1 = JPEGEncodeMCU(1, pJPEG, pJPEG->MCUs, pJPEG->iDCPred1, bSparse);
-            JPEGFDCT(&pJPEG->MCUc[2*DCTSIZE], pJPEG->MCUs);
-            // Cr
-            bSparse = JPEGQuantize(pJPEG, pJPEG->MCUs, 1);
-            pJPEG->iDCPred2 = JPEGEncodeMCU(1, pJPEG, pJPEG->MCUs, pJPEG->iDCPred2, bSparse);
-        } else { // must be 420
-            JPEGGetMCU22(pPixels, pJPEG, iPitch);
-            JPEGFDCT(&pJPEG->MCUc[0*DCTSIZE], pJPEG->MCUs); // Y0
-            bSparse = JPEGQuantize(pJPEG, pJPEG->MCUs, 0);
-            pJPEG->iDCPred0 = JPEGEncodeMCU(0, pJPEG, pJPEG->MCUs, pJPEG->iDCPred0, bSparse);
-            JPEGFDCT(&pJPEG->MCUc[1*DCTSIZE], pJPEG->MCUs); // Y1
-            bSparse = JPEGQuantize(pJPEG, pJPEG->MCUs, 0);
-            pJPEG->iDCPred0 = JPEGEncodeMCU(0, pJPEG, pJPEG->MCUs, pJPEG->iDCPred0, bSparse);
-            JPEGFDCT(&pJPEG->MCUc[2*DCTSIZE], pJPEG->MCUs); // Y2
-            bSparse = JPEGQuantize(pJPEG, pJPEG->MCUs, 0);
-            pJPEG->iDCPred0 = JPEGEncodeMCU(0, pJPEG, pJPEG->MCUs, pJPEG->iDCPred0, bSparse);
-            JPEGFDCT(&pJPEG->MCUc[3*DCTSIZE], pJPEG->MCUs); // Y3
+    } else if (pJPEG->ucSubSample == JPEGE_SUBSAMPLE_444) {
+        JPEGFDCT(&pJPEG->MCUc[0*DCTSIZE], pJPEG->MCUs);
+        pJPEG->sDC[0] = pJPEG->MCUs[0];
+        // Y
+        bSparse = JPEGQuantize(pJPEG, pJPEG->MCUs, 0);
+        pJPEG->iDCPred0 = JPEGEncodeMCU(0, pJPEG, pJPEG->MCUs, pJPEG->iDCPred0, bSparse);
+        JPEGFDCT(&pJPEG->MCUc[1*DCTSIZE], pJPEG->MCUs);
+        pJPEG->sDC[1] = pJPEG->MCUs[0];
+        // Cb
+        bSparse = JPEGQuantize(pJPEG, pJPEG->MCUs, 1);
+        pJPEG->iDCPred1 = JPEGEncodeMCU(1, pJPEG, pJPEG->MCUs, pJPEG->iDCPred1, bSparse);
+        JPEGFDCT(&pJPEG->MCUc[2*DCTSIZE], pJPEG->MCUs);
+        pJPEG->sDC[2] = pJPEG->MCUs[0];
+        // Cr
+        bSparse = JPEGQuantize(pJPEG, pJPEG->MCUs, 1);
+        pJPEG->iDCPred2 = JPEGEncodeMCU(2, pJPEG, pJPEG->MCUs, pJPEG->iDCPred2, bSparse);
+    } else { // 420 or 422; Cb/Cr are always blocks 4 and 5
+        int i;
+        for (i=0; i<((pEncode->cy == 16) ? 4 : 2); i++) { // Y0-Y3 (Y0-Y1 for 422)
+            JPEGFDCT(&pJPEG->MCUc[i*DCTSIZE], pJPEG->MCUs);
+            pJPEG->sDC[i] = pJPEG->MCUs[0];
             bSparse = JPEGQuantize(pJPEG, pJPEG->MCUs, 0);
             pJPEG->iDCPred0 = JPEGEncodeMCU(0, pJPEG, pJPEG->MCUs, pJPEG->iDCPred0, bSparse);
-            JPEGFDCT(&pJPEG->MCUc[4*DCTSIZE], pJPEG->MCUs); // Cb
-            bSparse = JPEGQuantize(pJPEG, pJPEG->MCUs, 1);
-            pJPEG->iDCPred1 = JPEGEncodeMCU(1, pJPEG, pJPEG->MCUs, pJPEG->iDCPred1, bSparse);
-            JPEGFDCT(&pJPEG->MCUc[5*DCTSIZE], pJPEG->MCUs); // Cr
-            bSparse = JPEGQuantize(pJPEG, pJPEG->MCUs, 1);
-            pJPEG->iDCPred2 = JPEGEncodeMCU(1, pJPEG, pJPEG->MCUs, pJPEG->iDCPred2, bSparse);
-        } // 420 subsample
-        if (pEncode->x >= (pJPEG->iWidth - pEncode->cx)) { // end of the row?
-            // Store the restart marker
+        }
+        JPEGFDCT(&pJPEG->MCUc[4*DCTSIZE], pJPEG->MCUs); // Cb
+        pJPEG->sDC[4] = pJPEG->MCUs[0];
+        bSparse = JPEGQuantize(pJPEG, pJPEG->MCUs, 1);
+        pJPEG->iDCPred1 = JPEGEncodeMCU(1, pJPEG, pJPEG->MCUs, pJPEG->iDCPred1, bSparse);
+        JPEGFDCT(&pJPEG->MCUc[5*DCTSIZE], pJPEG->MCUs); // Cr
+        pJPEG->sDC[5] = pJPEG->MCUs[0];
+        bSparse = JPEGQuantize(pJPEG, pJPEG->MCUs, 1);
+        pJPEG->iDCPred2 = JPEGEncodeMCU(2, pJPEG, pJPEG->MCUs, pJPEG->iDCPred2, bSparse);
+    } // 420/422 subsample
+    if (pJPEG->ucThumbWidth) {
+        JPEGThumbAddMCU(pJPEG, pEncode);
+    }
+    if (pJPEG->iRestartMCUs && --pJPEG->iRestartLeft == 0) { // end of the restart interval
+        if (pJPEG->ucArithmetic)
+            JPEGArithFlush(pJPEG);
+        else
+            FlushCode(&pJPEG->pc);
+        *(pJPEG->pc.pOut)++ = 0xff; // store restart marker
+        *(pJPEG->pc.pOut)++ = (unsigned char) (0xd0 + (pJPEG->iRestart & 7));
+        pJPEG->iRestart++;
+        pJPEG->iRestartLeft = pJPEG->iRestartMCUs;
+        pJPEG->iDCPred0 = pJPEG->iDCPred1 = pJPEG->iDCPred2 = 0; // reset the DC predictors
+        if (pJPEG->ucArithmetic) // each interval starts with fresh statistics
+            JPEGArithReset(pJPEG);
+    } else if (pJPEG->pProgArena == NULL && pJPEG->pSegment == NULL && pEncode->x >= (pJPEG->iWidth - pEncode->cx) && pEncode->y + pEncode->cy >= pJPEG->iHeight) {
+        if (pJPEG->ucArithmetic) // last MCU in the middle of an interval
+            JPEGArithFlush(pJPEG);
+        else
             FlushCode(&pJPEG->pc);
-            *(pJPEG->pc.pOut)++ = 0xff; // store restart marker
-            *(pJPEG->pc.pOut)++ = (unsigned char) (0xd0 + (pJPEG->iRestart & 7));
-            pJPEG->iRestart++;
-            pJPEG->iDCPred0 = pJPEG->iDCPred1 = pJPEG->iDCPred2 = 0; // reset the DC predictors
-            pEncode->x = 0;
-            pEncode->y += pEncode->cy;
-            if (pEncode->y >= pJPEG->iHeight && pJPEG->pOutput) {
-                pJPEG->iDataSize = (int)(pJPEG->pc.pOut - pJPEG->pOutput);
-            }
-        } else {
-            pEncode->x += pEncode->cx;
-        } // grayscale
+    }
+    if (pEncode->x >= (pJPEG->iWidth - pEncode->cx)) { // end of the row?
+        pEncode->x = 0;
+        pEncode->y += pEncode->cy;
+        if (pJPEG->ucThumbWidth && (((pEncode->y >> 3) & ((1 << pJPEG->ucThumbShift) - 1)) == 0 || pEncode->y >= pJPEG->iHeight)) {
+            JPEGThumbRow(pJPEG, ((pEncode->y - 1) >> 3) >> pJPEG->ucThumbShift); // this thumbnail row is complete
+        }
+        if (pEncode->y >= pJPEG->iHeight && pJPEG->pOutput) {
+            pJPEG->iDataSize = (int)(pJPEG->pc.pOut - pJPEG->pOutput);
+        }
+    } else {
+        pEncode->x += pEncode->cx;
+    }
+    if (pJPEG->pSegment && --pJPEG->iSegmentLeft == 0) {
+        JPEGSegmentEnd(pJPEG);
     }
     if (pJPEG->pc.pOut >= pJPEG->pHighWater) { // out of space or need to write incremental buffer
         if (pJPEG->pOutput) { // the user-supplied buffer is not big enough
-            pJPEG->iError = JPEGE_NO_BUFFER;
-            return JPEGE_NO_BUFFER;
+            if (JPEGGrowOutput(pJPEG, 0) != JPEGE_SUCCESS)
+                return JPEGE_NO_BUFFER;
         } else { // write current block of data
-            int iLen = (int)(pJPEG->pc.pOut - pJPEG->ucFileBuf);
-            pJPEG->pfnWrite(&pJPEG->JPEGFile, pJPEG->ucFileBuf, iLen);
+            int iLen = (int)(pJPEG->pc.pOut - pJPEG->pFileBuf);
+            pJPEG->pfnWrite(&pJPEG->JPEGFile, pJPEG->pFileBuf, iLen);
             pJPEG->iDataSize += iLen;
-            pJPEG->pc.pOut = pJPEG->ucFileBuf;
+            pJPEG->pc.pOut = pJPEG->pFileBuf;
         }
     }
     return JPEGE_SUCCESS;
+} /* JPEGEncodeSamples() */
+
+//
+// Compress one MCU of full-size pixels and advance to the next
+// ucPixelType is the format of pPixels, which can differ from the source
+// format when the pixels were converted on the way in (e.g. downscaling)
+//
+int JPEGCompressMCU(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch, uint8_t ucPixelType)
+{
+    int x, y;
+    uint8_t *pTemp = pJPEG->ucPixelTemp; // 8-bit copy of 16-bit pixels or alpha values
+
+    if (pEncode->y >= pJPEG->iHeight) {
+        // the image is already complete or was not initialized properly
+        pJPEG->iError = JPEGE_INVALID_PARAMETER;
+        return JPEGE_INVALID_PARAMETER;
+    }
+    if (ucPixelType == JPEGE_PIXEL_GRAY16 || ucPixelType == JPEGE_PIXEL_RGB48) {
+        // tone-map to 8 bits once, then use the regular samplers
+        JPEGConvert16(pJPEG, pEncode, pPixels, iPitch, pTemp);
+        ucPixelType = (ucPixelType == JPEGE_PIXEL_GRAY16) ? JPEGE_PIXEL_GRAYSCALE : JPEGE_PIXEL_RGB888;
+        iPitch = pEncode->cx * ucPixelBytes[ucPixelType];
+        pPixels = pTemp;
+    } else if (pJPEG->ucAlphaPlane && ucPixelType != JPEGE_PIXEL_GRAYSCALE) { // 32-bit pixels
+        for (y=0; y<8; y++) {
+            for (x=0; x<8; x++) {
+                pTemp[y*8 + x] = pPixels[y * iPitch + x*4 + 3];
+            }
+        }
+        ucPixelType = JPEGE_PIXEL_GRAYSCALE;
+        iPitch = 8;
+        pPixels = pTemp;
+    }
+    if (ucPixelType == JPEGE_PIXEL_GRAYSCALE) {
+        JPEGGetMCU(pPixels, iPitch, pJPEG->MCUc);
+    } else if (pJPEG->ucNumComponents == 1) { // color source, luma-only output
+        JPEGSampleLuma(pPixels, pJPEG->MCUc, iPitch, ucPixelType);
+    } else if (pJPEG->ucSubSample == JPEGE_SUBSAMPLE_444) {
+        JPEGGetMCU11(pPixels, pJPEG, iPitch, ucPixelType);
+    } else if (pJPEG->ucSubSample == JPEGE_SUBSAMPLE_422) {
+        JPEGGetMCU21(pPixels, pJPEG, iPitch, ucPixelType);
+    } else { // must be 420
+        JPEGGetMCU22(pPixels, pJPEG, iPitch, ucPixelType);
+    }
+    return JPEGEncodeSamples(pJPEG, pEncode);
+} /* JPEGCompressMCU() */
+
+int JPEGAddMCU(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch)
+{
+    uint8_t *pTemp = pJPEG->ucMCUTemp; // holds a padded copy of partial edge MCUs
+
+    if (pJPEG->ucOrientation != JPEGE_ORIENT_NONE || pJPEG->ucScale || pJPEG->ucPixelType >= JPEGE_PIXEL_I420 || pJPEG->pAlpha) { // needs the whole image (addFrame)
+        pJPEG->iError = JPEGE_UNSUPPORTED_FEATURE;
+        return JPEGE_UNSUPPORTED_FEATURE;
+    }
+    if (pEncode->x + pEncode->cx > pJPEG->iWidth || pEncode->y + pEncode->cy > pJPEG->iHeight) {
+        pPixels = JPEGPadMCU(pJPEG, pEncode, pPixels, &iPitch, pTemp);
+    }
+    return JPEGCompressMCU(pJPEG, pEncode, pPixels, iPitch, pJPEG->ucPixelType);
 } /* JPEGAddMCU() */
 
+//
+// Encode the next MCU of a complete frame
+// Picks the downscale, gather or direct path depending on the encoder settings
+//
+int JPEGAddFrameMCU(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch)
+{
+uint8_t *pTemp = pJPEG->ucMCUTemp; // holds gathered or padded MCUs
+uint8_t ucType;
+
+    if (pJPEG->ucPixelType >= JPEGE_PIXEL_BAYER_RGGB) { // demosaic into a B,G,R tile
+        if (pEncode->y >= pJPEG->iHeight || iPitch < pJPEG->iWidth * ucPixelBytes[pJPEG->ucPixelType]) {
+            pJPEG->iError = JPEGE_INVALID_PARAMETER;
+            return JPEGE_INVALID_PARAMETER;
+        }
+        JPEGDemosaicMCU(pJPEG, pEncode, pPixels, iPitch, pTemp);
+        return JPEGCompressMCU(pJPEG, pEncode, pTemp, pEncode->cx * 3, JPEGE_PIXEL_RGB888);
+    }
+    if (pJPEG->ucPixelType >= JPEGE_PIXEL_I420) { // planar YUV goes straight into the MCUs
+        if (pEncode->y >= pJPEG->iHeight || iPitch < ((pJPEG->ucPixelType == JPEGE_PIXEL_I420) ? pJPEG->iWidth : (pJPEG->iWidth + 1) & ~1)) {
+            pJPEG->iError = JPEGE_INVALID_PARAMETER;
+            return JPEGE_INVALID_PARAMETER;
+        }
+        JPEGGetMCUPlanar(pJPEG, pEncode, pPixels, iPitch);
+        return JPEGEncodeSamples(pJPEG, pEncode);
+    }
+    if (pJPEG->ucScale) {
+        ucType = JPEGGatherScaledMCU(pJPEG, pEncode, pPixels, iPitch, pTemp);
+        return JPEGCompressMCU(pJPEG, pEncode, pTemp, pEncode->cx * ucPixelBytes[ucType], ucType);
+    }
+    if ((pJPEG->ucOrientation != JPEGE_ORIENT_NONE && pJPEG->ucOrientation != JPEGE_ORIENT_FLIPV) || pJPEG->ucPairOffset) {
+        JPEGGatherMCU(pJPEG, pEncode, pPixels, iPitch, pTemp);
+        return JPEGCompressMCU(pJPEG, pEncode, pTemp, pEncode->cx * ucPixelBytes[pJPEG->ucPixelType], pJPEG->ucPixelType);
+    }
+    if (pJPEG->ucOrientation == JPEGE_ORIENT_FLIPV) {
+        // a vertical flip is just a bottom-up walk through the source
+        pPixels += (pJPEG->iSrcHeight - 1) * iPitch;
+        iPitch = -iPitch;
+    }
+    pPixels += pEncode->y * iPitch + pEncode->x * ucPixelBytes[pJPEG->ucPixelType];
+    if (pEncode->x + pEncode->cx > pJPEG->iWidth || pEncode->y + pEncode->cy > pJPEG->iHeight) {
+        pPixels = JPEGPadMCU(pJPEG, pEncode, pPixels, &iPitch, pTemp);
+    }
+    return JPEGCompressMCU(pJPEG, pEncode, pPixels, iPitch, pJPEG->ucPixelType);
+} /* JPEGAddFrameMCU() */
+
+//
+// Catch up the alpha encoder on the MCU rows which the color encoder has
+// finished, while those source lines are still in the cache
+//
+int JPEGAddAlphaRows(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch)
+{
+int iRows, rc = JPEGE_SUCCESS;
+JPEGE_IMAGE *pAlpha = pJPEG->pAlpha;
+JPEGENCODE *pAE = pJPEG->pAlphaEncode;
+
+    iRows = (pEncode->y < pJPEG->iHeight) ? pEncode->y : 0x7fffffff;
+    while (rc == JPEGE_SUCCESS && pAE->y < pAlpha->iHeight && pAE->y + pAE->cy <= iRows) {
+        rc = JPEGAddFrameMCU(pAlpha, pAE, pPixels, iPitch);
+    }
+    if (rc != JPEGE_SUCCESS) pJPEG->iError = rc;
+    return rc;
+} /* JPEGAddAlphaRows() */
+
 int JPEGAddFrame(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch)
 {
 int x, y;
-uint8_t *s;
 int rc = JPEGE_SUCCESS;
-int iBPMCU;
-
-    iBPMCU = pEncode->cx;
-    switch (pJPEG->ucPixelType) {
-        case JPEGE_PIXEL_GRAYSCALE:
-           break; // 1 byte per pixel
-        case JPEGE_PIXEL_RGB565:
-           iBPMCU *= 2;
-           break;
-        case JPEGE_PIXEL_RGB888:
-           iBPMCU *= 3;
-           break;
-        case JPEGE_PIXEL_ARGB8888:
-           iBPMCU *= 4;
-           break;
-        case JPEGE_PIXEL_YUV422:
-           iBPMCU *= 2; // average 2 bytes per pixel
-           break;
+
+    if (pJPEG->pSegment) { // just the MCUs of this segment
+        while (pJPEG->iSegmentLeft && rc == JPEGE_SUCCESS) {
+            rc = JPEGAddFrameMCU(pJPEG, pEncode, pPixels, iPitch);
+        }
+        return rc;
     }
     for (y = 0; y < pJPEG->iMCUHeight && rc == JPEGE_SUCCESS; y++) {
-        s = &pPixels[y * pEncode->cy * iPitch];
         for (x = 0; x<pJPEG->iMCUWidth && rc == JPEGE_SUCCESS; x++) {
-            rc = JPEGAddMCU(pJPEG, pEncode, s, iPitch);
-            s += iBPMCU;
+            rc = JPEGAddFrameMCU(pJPEG, pEncode, pPixels, iPitch);
         } // for x
+        if (pJPEG->pAlpha && rc == JPEGE_SUCCESS)
+            rc = JPEGAddAlphaRows(pJPEG, pEncode, pPixels, iPitch);
     } // for y
     return rc;
 } /* JPEGAddFrame() */
 
+//
+// Encode the next MCU of a 1/8 size rendition from the block averages
+// (DC values) of its parent, which were collected into planes of signed
+// Y/Cb/Cr samples by JPEGAddFramePyramid()
+//
+int JPEGEncodeFromDC(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, signed char *pPlanes, int iPlaneWidth)
+{
+    int x, y, b, sx, sy, cx, cy, iChromaW;
+    signed char *pY, *pCb, *pCr, *d;
+
+    pY = pPlanes;
+    iChromaW = (pJPEG->ucSubSample == JPEGE_SUBSAMPLE_420) ? iPlaneWidth/2 : iPlaneWidth;
+    pCb = &pPlanes[iPlaneWidth * pEncode->cy];
+    pCr = &pCb[iChromaW * 8];
+    // the planes are only valid up to the edges of the image
+    cx = pJPEG->iWidth - pEncode->x;
+    cy = pJPEG->iHeight - pEncode->y;
+    if (pEncode->cx == 16) { // 420: four Y blocks, Cb/Cr cover all of them
+        for (b=0; b<4; b++) {
+            d = &pJPEG->MCUc[b * DCTSIZE];
+            for (y=0; y<8; y++) {
+                sy = (b >> 1)*8 + y;
+                if (sy >= cy) sy = cy - 1;
+                for (x=0; x<8; x++) {
+                    sx = (b & 1)*8 + x;
+                    if (sx >= cx) sx = cx - 1;
+                    *d++ = pY[sy * iPlaneWidth + pEncode->x + sx];
+                }
+            }
+        }
+        cx = (cx + 1) >> 1; // valid chroma samples
+        cy = (cy + 1) >> 1;
+        pCb += pEncode->x >> 1;
+        pCr += pEncode->x >> 1;
+        b = 4;
+    } else {
+        d = pJPEG->MCUc;
+        for (y=0; y<8; y++) {
+            sy = (y < cy) ? y : cy - 1;
+            for (x=0; x<8; x++) {
+                *d++ = pY[sy * iPlaneWidth + pEncode->x + ((x < cx) ? x : cx - 1)];
+            }
+        }
+        pCb += pEncode->x;
+        pCr += pEncode->x;
+        b = 1;
+    }
+    if (pJPEG->ucNumComponents == 3) {
+        d = &pJPEG->MCUc[b * DCTSIZE];
+        for (y=0; y<8; y++) {
+            sy = ((y < cy) ? y : cy - 1) * iChromaW;
+            for (x=0; x<8; x++) {
+                sx = sy + ((x < cx) ? x : cx - 1);
+                d[DCTSIZE] = pCr[sx];
+                *d++ = pCb[sx];
+            }
+        }
+    }
+    return JPEGEncodeSamples(pJPEG, pEncode);
+} /* JPEGEncodeFromDC() */
+
+//
+// Encode several renditions of the same frame (e.g. full, 1/2 and 1/8 size)
+// in a single pass over the source. Each encoder has its own output and was
+// started with the same source size and pixel type, but its own scale.
+// The MCU rows of the renditions are interleaved so that the source lines
+// are only read once from (slow) memory.
+// When pDCBuf is provided, a 1/8 size rendition of the unscaled parent (with
+// the same orientation and subsampling) is built from the parent's DC values
+// instead of reading the source again; it needs 24 bytes per pixel of the
+// 1/8 image width rounded up to a multiple of 16 (8 for grayscale)
+//
+int JPEGAddFramePyramid(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, JPEGE_IMAGE **pChildren, JPEGENCODE **pChildEncodes, int iChildren, uint8_t *pPixels, int iPitch, uint8_t *pDCBuf, int iDCBufSize)
+{
+int i, b, px, py, iRows, rc = JPEGE_SUCCESS;
+int iDCChild = -1, iPlaneW = 0, iChromaW = 0;
+JPEGE_IMAGE *pChild;
+JPEGENCODE *pCE;
+signed char *pY = NULL, *pCb = NULL, *pCr = NULL;
+
+    if (pPixels == NULL || iChildren < 0 || (iChildren > 0 && (pChildren == NULL || pChildEncodes == NULL))) {
+        pJPEG->iError = JPEGE_INVALID_PARAMETER;
+        return JPEGE_INVALID_PARAMETER;
+    }
+    for (i=0; i<iChildren; i++) {
+        pChild = pChildren[i];
+        if (pChild->iSrcWidth != pJPEG->iSrcWidth || pChild->iSrcHeight != pJPEG->iSrcHeight || pChild->ucPixelType != pJPEG->ucPixelType) {
+            pJPEG->iError = JPEGE_INVALID_PARAMETER;
+            return JPEGE_INVALID_PARAMETER;
+        }
+        if (iDCChild < 0 && pDCBuf != NULL && pJPEG->ucScale == JPEGE_SCALE_NONE && pChild->ucScale == JPEGE_SCALE_EIGHTH &&
+            pChild->ucOrientation == pJPEG->ucOrientation && pChildEncodes[i]->cx == pEncode->cx && pChildEncodes[i]->cy == pEncode->cx && pEncode->cy == pEncode->cx && // same square MCUs (not 422)
+            pChild->ucNumComponents == pJPEG->ucNumComponents &&
+            (!cOrientXForm[pJPEG->ucOrientation][4] || (pJPEG->iSrcWidth & 7) == 0) && // mirrored blocks must line up
+            (!cOrientXForm[pJPEG->ucOrientation][5] || (pJPEG->iSrcHeight & 7) == 0)) {
+            iPlaneW = pChild->iMCUWidth * pChildEncodes[i]->cx;
+            if (iPlaneW * ((pChild->ucNumComponents == 1) ? 8 : 24) <= iDCBufSize) {
+                iDCChild = i;
+                iChromaW = (pChildEncodes[i]->cx == 16) ? iPlaneW/2 : iPlaneW;
+                pY = (signed char *)pDCBuf;
+                pCb = &pY[iPlaneW * pChildEncodes[i]->cy];
+                pCr = &pCb[iChromaW * 8];
+            }
+        }
+    } // for i
+    while (rc == JPEGE_SUCCESS && pEncode->y < pJPEG->iHeight) {
+        px = pEncode->x; py = pEncode->y;
+        rc = JPEGAddFrameMCU(pJPEG, pEncode, pPixels, iPitch);
+        if (iDCChild >= 0 && rc == JPEGE_SUCCESS) { // keep the block averages
+            pCE = pChildEncodes[iDCChild];
+            px >>= 3; py = (py >> 3) - pCE->y; // child pixels
+            if (pEncode->cx == 16) {
+                for (b=0; b<4; b++) {
+                    pY[(py + (b >> 1)) * iPlaneW + px + (b & 1)] = (signed char)((pJPEG->sDC[b] + 32) >> 6);
+                }
+                i = (py >> 1) * iChromaW + (px >> 1);
+                pCb[i] = (signed char)((pJPEG->sDC[4] + 32) >> 6);
+                pCr[i] = (signed char)((pJPEG->sDC[5] + 32) >> 6);
+            } else {
+                i = py * iPlaneW + px;
+                pY[i] = (signed char)((pJPEG->sDC[0] + 32) >> 6);
+                if (pJPEG->ucNumComponents == 3) {
+                    pCb[i] = (signed char)((pJPEG->sDC[1] + 32) >> 6);
+                    pCr[i] = (signed char)((pJPEG->sDC[2] + 32) >> 6);
+                }
+            }
+        }
+        if (pEncode->x != 0 && pEncode->y < pJPEG->iHeight) continue; // not the end of a row yet
+        if (pJPEG->pAlpha && rc == JPEGE_SUCCESS)
+            rc = JPEGAddAlphaRows(pJPEG, pEncode, pPixels, iPitch);
+        // catch up the smaller renditions on the rows which are now complete
+        iRows = (pEncode->y < pJPEG->iHeight) ? (pEncode->y << pJPEG->ucScale) : 0x7fffffff;
+        for (i=0; i<iChildren && rc == JPEGE_SUCCESS; i++) {
+            pChild = pChildren[i];
+            pCE = pChildEncodes[i];
+            while (rc == JPEGE_SUCCESS && pCE->y < pChild->iHeight && ((i == iDCChild) ? (pCE->y + pCE->cy) << 3 : (pCE->y + pCE->cy) << pChild->ucScale) <= iRows) {
+                do {
+                    if (i == iDCChild)
+                        rc = JPEGEncodeFromDC(pChild, pCE, pY, iPlaneW);
+                    else
+                        rc = JPEGAddFrameMCU(pChild, pCE, pPixels, iPitch);
+                } while (rc == JPEGE_SUCCESS && pCE->x != 0);
+                if (rc != JPEGE_SUCCESS) pJPEG->iError = rc;
+            }
+        } // for i
+    } // while
+    return rc;
+} /* JPEGAddFramePyramid() */
+//
+// Encode a rectangle of a larger image (e.g. a crop or region of interest)
+// straight from the source without copying it into a temporary buffer
+//
+int JPEGAddFrameRect(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch, int x, int y, int w, int h)
+{
+int rc;
+
+    if (pPixels == NULL || x < 0 || y < 0 || w != pJPEG->iSrcWidth || h != pJPEG->iSrcHeight) {
+        pJPEG->iError = JPEGE_INVALID_PARAMETER;
+        return JPEGE_INVALID_PARAMETER;
+    }
+    if (pJPEG->ucPixelType >= JPEGE_PIXEL_I420) { // the chroma planes are found from the frame height (Bayer edges are mirrored)
+        pJPEG->iError = JPEGE_UNSUPPORTED_FEATURE;
+        return JPEGE_UNSUPPORTED_FEATURE;
+    }
+    pPixels += y * iPitch;
+    if (JPEGE_IS_PACKED422(pJPEG->ucPixelType)) {
+        // an odd left edge splits the U/V pairs; the gather step re-pairs them
+        pPixels += (x >> 1) * 4;
+        pJPEG->ucPairOffset = (uint8_t)(x & 1);
+    } else {
+        pPixels += x * ucPixelBytes[pJPEG->ucPixelType];
+    }
+    rc = JPEGAddFrame(pJPEG, pEncode, pPixels, iPitch);
+    pJPEG->ucPairOffset = 0;
+    return rc;
+} /* JPEGAddFrameRect() */
+
+//
+// Start a worker encoder on a range of MCUs of the image that pMain has
+// begun. It gets a copy of the main encoder's settings and tables, and
+// its output goes to its own buffer, so the workers can run in parallel.
+//
+int JPEGSegmentBegin(JPEGE_IMAGE *pJPEG, JPEGE_IMAGE *pMain, JPEGENCODE *pEncode, JPEGE_SEGMENT *pSegment, int iFirstMCU, int iMCUs, uint8_t *pBuffer, int iBufferSize)
+{
+    if (pJPEG == NULL || pMain == NULL || pEncode == NULL || pSegment == NULL || pBuffer == NULL || iBufferSize < 1024) {
+        return JPEGE_INVALID_PARAMETER;
+    }
+    if (pMain->iMCUWidth == 0 || iFirstMCU < 0 || iMCUs < 1 || iFirstMCU + iMCUs > pMain->iMCUWidth * pMain->iMCUHeight) {
+        return JPEGE_INVALID_PARAMETER;
+    }
+    if (pMain->iRestartMCUs || pMain->pProgArena || pMain->ucArithmetic || pMain->ucThumbWidth || pMain->pAlpha || pMain->pSegment) {
+        return JPEGE_UNSUPPORTED_FEATURE; // the segments are joined into a single entropy-coded Huffman stream
+    }
+    memcpy(pJPEG, pMain, sizeof(JPEGE_IMAGE));
+    pJPEG->pOutput = pBuffer;
+    pJPEG->iBufferSize = iBufferSize;
+    pJPEG->pHighWater = &pBuffer[iBufferSize - 512];
+    pJPEG->pfnGrow = NULL; // the caller's segment buffer stays put
+    pJPEG->pc.pOut = pBuffer;
+    pJPEG->pc.iLen = pJPEG->pc.ulAcc = 0;
+    pJPEG->iDataSize = 0;
+    pJPEG->iDCPred0 = pJPEG->iDCPred1 = pJPEG->iDCPred2 = 0;
+    pJPEG->pSegment = pSegment;
+    pJPEG->iSegmentLeft = iMCUs;
+    pJPEG->ucSegFirst = (uint8_t)((1 << pJPEG->ucNumComponents) - 1);
+    memset(pSegment, 0, sizeof(JPEGE_SEGMENT));
+    pSegment->iFirstMCU = iFirstMCU;
+    pSegment->iMCUs = iMCUs;
+    // MCU size as in JPEGEncodeBegin()
+    pEncode->cx = (pJPEG->ucNumComponents == 1 || pJPEG->ucSubSample == JPEGE_SUBSAMPLE_444) ? 8 : 16;
+    pEncode->cy = (pEncode->cx == 16 && pJPEG->ucSubSample == JPEGE_SUBSAMPLE_420) ? 16 : 8;
+    pEncode->x = (iFirstMCU % pJPEG->iMCUWidth) * pEncode->cx;
+    pEncode->y = (iFirstMCU / pJPEG->iMCUWidth) * pEncode->cy;
+    return JPEGE_SUCCESS;
+} /* JPEGSegmentBegin() */
+//
+// Copy bits iFrom up to iTo of a segment to the output
+//
+void JPEGSpliceCopy(JPEGE_IMAGE *pJPEG, const uint8_t *pData, int iFrom, int iTo)
+{
+    uint32_t ulBits;
+    int i, iCount;
+
+    while (iFrom < iTo && pJPEG->iError == JPEGE_SUCCESS) {
+        iCount = (iTo - iFrom > 16) ? 16 : iTo - iFrom;
+        ulBits = 0;
+        for (i = iFrom >> 3; i <= (iFrom + iCount - 1) >> 3; i++) { // up to 3 bytes
+            ulBits |= (uint32_t)pData[i] << (16 - 8 * (i - (iFrom >> 3)));
+        }
+        JPEGProgPutBits(pJPEG, ulBits >> (24 - (iFrom & 7) - iCount), iCount);
+        iFrom += iCount;
+    }
+} /* JPEGSpliceCopy() */
+//
+// Length of the code of a DC difference; it's written when bWrite is set
+//
+int JPEGSpliceDC(JPEGE_IMAGE *pJPEG, int iComponent, int iDiff, int bWrite)
+{
+    unsigned short *pHuff = (unsigned short *)pJPEG->huffdc[(iComponent) ? 1 : 0];
+    int iSize, iMag = (iDiff < 0) ? -iDiff : iDiff;
+
+    for (iSize = 0; (iMag >> iSize); iSize++) {};
+    if (bWrite) {
+        JPEGProgPutBits(pJPEG, pHuff[iSize], pHuff[256 + iSize]);
+        if (iSize) // negative values are stored as iDiff-1
+            JPEGProgPutBits(pJPEG, (uint32_t)((iDiff < 0) ? iDiff - 1 : iDiff), iSize);
+    }
+    return pHuff[256 + iSize] + iSize;
+} /* JPEGSpliceDC() */
+//
+// Join the segments of the whole image (in order) into the output
+// The first DC code of each component in a segment is coded again against
+// the DC predictor at the end of the previous segment.
+//
+int JPEGSpliceSegments(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, JPEGE_SEGMENT *pSegments, int iCount)
+{
+    JPEGE_SEGMENT *pSeg;
+    int i, c, iBit, iMCU, iPred[3];
+
+    if (pJPEG == NULL || pEncode == NULL || pSegments == NULL || iCount < 1 || pEncode->x != 0 || pEncode->y != 0) {
+        return JPEGE_INVALID_PARAMETER; // the image must not be started yet
+    }
+    if (pJPEG->iRestartMCUs || pJPEG->pProgArena || pJPEG->ucArithmetic || pJPEG->ucThumbWidth || pJPEG->pAlpha) {
+        pJPEG->iError = JPEGE_UNSUPPORTED_FEATURE;
+        return JPEGE_UNSUPPORTED_FEATURE;
+    }
+    for (i=0, iMCU=0; i<iCount; i++) { // they must cover the image without gaps
+        if (pSegments[i].iFirstMCU != iMCU || pSegments[i].pData == NULL) {
+            pJPEG->iError = JPEGE_INVALID_PARAMETER;
+            return JPEGE_INVALID_PARAMETER;
+        }
+        iMCU += pSegments[i].iMCUs;
+    }
+    if (iMCU != pJPEG->iMCUWidth * pJPEG->iMCUHeight) {
+        pJPEG->iError = JPEGE_INVALID_PARAMETER;
+        return JPEGE_INVALID_PARAMETER;
+    }
+    iPred[0] = iPred[1] = iPred[2] = 0;
+    for (i=0; i<iCount && pJPEG->iError == JPEGE_SUCCESS; i++) {
+        pSeg = &pSegments[i];
+        iBit = 0;
+        for (c=0; c<pJPEG->ucNumComponents; c++) {
+            JPEGSpliceCopy(pJPEG, pSeg->pData, iBit, pSeg->iDCBit[c]);
+            JPEGSpliceDC(pJPEG, c, pSeg->iFirstDC[c] - iPred[c], 1);
+            iBit = pSeg->iDCBit[c] + JPEGSpliceDC(pJPEG, c, pSeg->iFirstDC[c], 0);
+            iPred[c] = pSeg->iLastDC[c];
+        }
+        JPEGSpliceCopy(pJPEG, pSeg->pData, iBit, pSeg->iBits);
+    }
+    if (JPEGProgCheckOutput(pJPEG, 16) == JPEGE_SUCCESS) {
+        FlushCode(&pJPEG->pc);
+        if (pJPEG->pOutput)
+            pJPEG->iDataSize = (int)(pJPEG->pc.pOut - pJPEG->pOutput);
+    }
+    pEncode->x = 0;
+    pEncode->y = pJPEG->iHeight; // the image is complete
+    return pJPEG->iError;
+} /* JPEGSpliceSegments() */
+//
+// Estimate the size of the JPEG from a sample of its MCUs
+// Every iStep-th MCU is encoded (after the one to its left, so that its DC
+// difference is realistic) by a temporary encoder in the caller's pWork
+// (JPEGE_PREDICT_WORK_SIZE bytes) and the bits of the sample are scaled up
+// to the whole image. The default settings are used.
+//
+int JPEGPredictSize(uint8_t *pWork, int iWorkSize, uint8_t *pPixels, int iPitch, int iWidth, int iHeight, uint8_t ucPixelType, uint8_t ucSubSample, uint8_t ucQFactor, int iStep)
+{
+    JPEGE_IMAGE *pJPEG;
+    JPEGENCODE enc;
+    uint8_t *pStart;
+    int i, x, y, iMCUs, iHeader, iSampled, iRows;
+    int64_t llBits;
+
+    if (pWork == NULL || iWorkSize < JPEGE_PREDICT_WORK_SIZE || pPixels == NULL || iStep < 1) {
+        return 0;
+    }
+    pJPEG = (JPEGE_IMAGE *)(((intptr_t)pWork + 7) & ~(intptr_t)7);
+    memset(pJPEG, 0, sizeof(JPEGE_IMAGE));
+    pJPEG->pOutput = pJPEG->ucFileBuf; // only the header and one MCU at a time
+    pJPEG->iBufferSize = JPEGE_FILE_BUF_SIZE;
+    pJPEG->pHighWater = &pJPEG->ucFileBuf[JPEGE_FILE_BUF_SIZE - 512];
+    if (JPEGEncodeBegin(pJPEG, &enc, iWidth, iHeight, ucPixelType, ucSubSample, ucQFactor, JPEGE_ORIENT_NONE, JPEGE_SCALE_NONE) != JPEGE_SUCCESS) {
+        return 0;
+    }
+    pStart = pJPEG->pc.pOut;
+    iHeader = (int)(pStart - pJPEG->ucFileBuf);
+    iRows = pJPEG->iMCUHeight;
+    pJPEG->iRestartMCUs = 0; // counted below
+    iMCUs = pJPEG->iMCUWidth * pJPEG->iMCUHeight;
+    llBits = 0;
+    iSampled = 0;
+    for (y = 0; y < pJPEG->iMCUHeight && pJPEG->iError == JPEGE_SUCCESS; y++) {
+        for (x = (int)(((uint32_t)y * 2654435761u) >> 16) % iStep; x < pJPEG->iMCUWidth; x += iStep) { // scrambled first column, so that regular patterns don't line up with the samples
+            enc.x = ((x) ? x-1 : 0) * enc.cx; // the one to the left sets up the DC predictors
+            enc.y = y * enc.cy;
+            pJPEG->iDCPred0 = pJPEG->iDCPred1 = pJPEG->iDCPred2 = 0; // as after a restart
+            if (x) {
+                JPEGAddFrameMCU(pJPEG, &enc, pPixels, iPitch);
+                pJPEG->pc.pOut = pStart;
+            }
+            i = (int)pJPEG->pc.iLen;
+            JPEGAddFrameMCU(pJPEG, &enc, pPixels, iPitch);
+            llBits += (pJPEG->pc.pOut - pStart) * 8 + (int)pJPEG->pc.iLen - i;
+            pJPEG->pc.pOut = pStart; // the next one goes in the same place
+            iSampled++;
+        }
+    }
+    if (pJPEG->iError != JPEGE_SUCCESS || iSampled == 0) {
+        return 0;
+    }
+    llBits = llBits * iMCUs / iSampled;
+    llBits += iRows * (16 + 4); // RSTn at the end of each row and about half a byte of padding
+    return iHeader + (int)((llBits + 7) >> 3) + 2; // + EOI
+} /* JPEGPredictSize() */